@@ -23,7 +23,6 @@ void write_binary_file(std::string file_name,
 int main() {
         std::cout << "build version " << (float)BUILD_VER << std::endl;
         BinaryAPI iBinaryApi;
-        BinaryAPI iBinaryApiForTime;
         json j_settings;
         std::ifstream i("settings.json");
         i >> j_settings;
@@ -35,7 +34,6 @@ int main() {
         iBinaryApi.init_symbols(symbols);
         //
         iBinaryApi.set_use_log(true);
-        iBinaryApiForTime.set_use_log(true);
         // инициализируем поток процентов выплат
         const double amount = j_settings["amount"];
         const int duration = j_settings["duration"];
@@ -68,7 +66,6 @@ int main() {
         //
 
         std::cout << "..." << std::endl;
-        unsigned long long servertime_last = 0;
         while(true) {
                 // для всех валютных пар
                 std::vector<double> buy_data; // проценты выплат
@@ -84,17 +81,10 @@ int main() {
                                 continue;
                 }
 
-                if(iBinaryApiForTime.get_servertime(servertime) != iBinaryApiForTime.OK) {
-                        iBinaryApiForTime.request_servertime();
+                // ждем начала следующей секунды по оценке времени сервера
+                if(iBinaryApi.wait_until_server_second(servertime) != iBinaryApi.OK) {
                         std::this_thread::sleep_for(std::chrono::milliseconds(450));
                         continue;
-                } else {
-                        if(servertime > servertime_last) {
-                                servertime_last = servertime;
-                        } else {
-                                std::this_thread::yield();
-                                continue;
-                        }
                 }
 #               if(1)
                 if(iBinaryApi.get_stream_proposal(buy_data, sell_data) == iBinaryApi.OK) {
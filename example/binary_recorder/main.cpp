@@ -18,12 +18,18 @@ void make_commit(std::string disk, std::string path, std::string new_file);
 int main() {
         std::cout << "build version " << (float)BUILD_VER << std::endl;
 
-        BinaryAPI iBinaryApi;
-        BinaryAPI iBinaryApiForTime;
-        BinaryAPI iBinaryApiForQuotes;
+        BinaryApiEventLoop event_loop; // один поток обслуживает оба соединения
+        // соединения устанавливаются одновременно
+        BinaryAPI iBinaryApi(event_loop, BinaryAPI::ASYNC_CONNECTION);
+        BinaryAPI iBinaryApiForQuotes(event_loop, BinaryAPI::ASYNC_CONNECTION);
+        std::future<int> ready = iBinaryApi.wait_ready_async(30000);
+        std::future<int> ready_for_quotes = iBinaryApiForQuotes.wait_ready_async(30000);
+        if(ready.get() != BinaryAPI::OK || ready_for_quotes.get() != BinaryAPI::OK) {
+                std::cout << "connection timeout" << std::endl;
+                return 0;
+        }
 
         iBinaryApi.set_use_log(true);
-        iBinaryApiForTime.set_use_log(true);
         iBinaryApiForQuotes.set_use_log(true);
 
         std::mutex make_commit_mutex_;
@@ -85,7 +91,6 @@ int main() {
         }
         //
         std::cout << "..." << std::endl;
-        unsigned long long servertime_last = 0;
         while(true) {
                 // для всех валютных пар
                 std::vector<double> buy_data; // проценты выплат
@@ -101,17 +106,10 @@ int main() {
                                 continue;
                 }
 
-                if(iBinaryApiForTime.get_servertime(servertime) != iBinaryApiForTime.OK) {
-                        iBinaryApiForTime.request_servertime();
+                // ждем начала следующей секунды по оценке времени сервера
+                if(iBinaryApi.wait_until_server_second(servertime) != iBinaryApi.OK) {
                         std::this_thread::sleep_for(std::chrono::milliseconds(450));
                         continue;
-                } else {
-                        if(servertime > servertime_last) {
-                                servertime_last = servertime;
-                        } else {
-                                std::this_thread::yield();
-                                continue;
-                        }
                 }
 #               if(1)
                 if(iBinaryApi.get_stream_proposal(buy_data, sell_data) == iBinaryApi.OK) {
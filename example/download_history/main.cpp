@@ -32,7 +32,11 @@ int main() {
                 std::cout << "candles_times.size() " << candles_times.size() << std::endl;
         }
 
-        std::cout << "get_ticks " << apiBinary.get_ticks_without_limits("frxEURUSD", prices, times, t1, t2) << std::endl;
+        // загружаем тики, держа в работе до 8 запросов одновременно
+        const int max_requests = 8;
+        double chunks_per_second = 0;
+        std::cout << "get_ticks " << apiBinary.get_ticks_without_limits("frxEURUSD", prices, times, t1, t2, max_requests, chunks_per_second) << std::endl;
+        std::cout << "chunks per second: " << chunks_per_second << std::endl;
         if(times.size() > 0) {
                 std::cout << "t1: " << t1 << "/" << times[0] << std::endl;
                 std::cout << "t2: " << t2 << "/" << times.back() << std::endl;
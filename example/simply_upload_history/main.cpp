@@ -56,10 +56,13 @@ int main() {
         int num_threads = std::thread::hardware_concurrency();
         std::cout << "hardware concurrency: " << num_threads << std::endl;
         std::vector<std::thread> threads(num_threads);
+        BinaryApiEventLoop event_loop; // соединения всех потоков загрузки обслуживает один цикл событий
         for(int t = 0; t < num_threads; ++t) {
                 threads[t] = std::thread([&, disk_name, path, folder_path_quotes_bars, folder_path_quotes_ticks, servertime, symbols, t, num_threads]() {
-                        BinaryAPI iBinaryApiForQuotes;
+                        BinaryAPI iBinaryApiForQuotes(event_loop);
                         iBinaryApiForQuotes.set_use_log(true);
+                        // все потоки загрузки делят общий лимит запросов процесса
+                        iBinaryApiForQuotes.set_budget_name("upload " + std::to_string(t));
                         for(size_t s = t; s < symbols.size(); s += num_threads) {
                                 bool is_skip_day_off = true;
                                 // проверим, есть ли смысл загружать котировки за выходные дни
@@ -0,0 +1,47 @@
+#include <iostream>
+#include "BinaryApiPool.hpp"
+
+int main() {
+        // 2 группы валютных пар, всего 3 соединения (одно резервное)
+        BinaryApiPool iBinaryApiPool(2);
+        std::vector<std::string> symbols;
+        symbols.push_back("R_10");
+        symbols.push_back("R_25");
+        symbols.push_back("R_50");
+        symbols.push_back("R_100");
+        iBinaryApiPool.init_symbols(symbols);
+
+        std::cout << "init_stream_quotations " << iBinaryApiPool.init_stream_quotations(60) << std::endl;
+        std::cout << "init_stream_proposal " << iBinaryApiPool.init_stream_proposal(10, 3, BinaryAPI::MINUTES, "USD") << std::endl;
+        std::cout << "..." << std::endl;
+        while(true) {
+                std::this_thread::sleep_for(std::chrono::seconds(10));
+                std::vector<std::vector<double>> close_data; // цены закрытия
+                std::vector<std::vector<unsigned long long>> time_data; // время открытия свечей
+                std::vector<double> buy_data; // проценты выплат
+                std::vector<double> sell_data;
+                if(iBinaryApiPool.get_stream_quotations(close_data, time_data) == BinaryAPI::OK &&
+                   iBinaryApiPool.get_stream_proposal(buy_data, sell_data) == BinaryAPI::OK) {
+                        // данные возвращаются в порядке массива symbols, какое бы соединение их ни получало
+                        for(size_t i = 0; i < symbols.size(); ++i) {
+                                std::cout << symbols[i] << " " << buy_data[i] << "/" << sell_data[i];
+                                if(close_data[i].size() > 0)
+                                        std::cout << " " << close_data[i].back() << " " << time_data[i].back();
+                                std::cout << std::endl;
+                        }
+                }
+                // после обрыва соединения группа переезжает на резервное соединение
+                std::vector<size_t> group_api;
+                const int standby = iBinaryApiPool.get_groups(group_api);
+                for(size_t g = 0; g < group_api.size(); ++g) {
+                        std::cout << "group " << g << " -> connection " << group_api[g] << std::endl;
+                }
+                std::cout << "standby connection " << standby << std::endl;
+                std::vector<double> rates;
+                iBinaryApiPool.get_rates(rates);
+                for(size_t i = 0; i < rates.size(); ++i) {
+                        std::cout << "connection " << i << ": " << rates[i] << " msg/s" << std::endl;
+                }
+                std::cout << std::endl;
+        }
+}
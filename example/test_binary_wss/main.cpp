@@ -16,7 +16,6 @@ int main() {
         std::cout << "init_stream_quotations " << iBinaryApi.init_stream_quotations(60) << std::endl;
         std::cout << "init_stream_proposal " << iBinaryApi.init_stream_proposal(10, 3, iBinaryApi.MINUTES, "USD") << std::endl;
         std::cout << "..." << std::endl;
-        unsigned long long servertime_last = 0;
         while(true) {
                 // для всех валютных пар
                 std::vector<std::vector<double>> close_data; // цены закрытия
@@ -25,20 +24,10 @@ int main() {
                 std::vector<double> sell_data;
                 unsigned long long servertime = 0;
 
-                //std::cout << "get_servertime" << std::endl;
-                if(iBinaryApi.get_servertime(servertime) != iBinaryApi.OK) {
-                        //std::cout << "request_servertime" << std::endl;
-                        iBinaryApi.request_servertime();
+                // время сервера оценивается локально, без запроса на каждой итерации
+                if(iBinaryApi.wait_until_server_second(servertime) != iBinaryApi.OK) {
                         std::this_thread::sleep_for(std::chrono::milliseconds(100));
                         continue;
-                } else {
-                        if(servertime > servertime_last) {
-                                servertime_last = servertime;
-                        } else {
-                                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                                //std::cout << "continue " << servertime << std::endl;
-                                continue;
-                        }
                 }
                 //std::cout << "get_stream_quotations" << std::endl;
                 if(iBinaryApi.get_stream_quotations(close_data, time_data) == iBinaryApi.OK &&
@@ -0,0 +1,102 @@
+#include <iostream>
+#include "BinaryAPI.hpp"
+
+using json = nlohmann::json;
+
+/// Записанные сообщения сервера (tick, ohlc, proposal)
+const std::vector<std::string> frames = {
+        "{\"echo_req\":{\"subscribe\":1,\"ticks\":\"R_50\"},\"msg_type\":\"tick\",\"subscription\":{\"id\":\"1e5ae7f4-6c84-1d1c-2fd1-5b7d16d1a7b1\"},"
+        "\"tick\":{\"ask\":\"123.4512\",\"bid\":\"123.4312\",\"epoch\":\"1546000000\",\"id\":\"1e5ae7f4-6c84-1d1c-2fd1-5b7d16d1a7b1\",\"quote\":\"123.4412\",\"symbol\":\"R_50\"}}",
+        "{\"echo_req\":{\"adjust_start_time\":1,\"count\":60,\"end\":\"latest\",\"granularity\":60,\"style\":\"candles\",\"subscribe\":1,\"ticks_history\":\"frxEURUSD\"},"
+        "\"msg_type\":\"ohlc\",\"ohlc\":{\"close\":\"1.13456\",\"epoch\":1546000012,\"granularity\":60,\"high\":\"1.13460\",\"id\":\"7d1c1e5a-2fd1-6c84-e7f4-b15b7d16d1a7\","
+        "\"low\":\"1.13440\",\"open\":\"1.13450\",\"open_time\":1546000000,\"symbol\":\"frxEURUSD\"}}",
+        "{\"echo_req\":{\"amount\":\"10.000000\",\"basis\":\"stake\",\"contract_type\":\"CALL\",\"currency\":\"USD\",\"duration\":\"3\",\"duration_unit\":\"m\","
+        "\"proposal\":1,\"subscribe\":1,\"symbol\":\"frxEURUSD\"},\"msg_type\":\"proposal\",\"proposal\":{\"ask_price\":\"10.00\",\"date_start\":1546000000,"
+        "\"display_value\":\"10.00\",\"id\":\"b15b7d16-d1a7-7d1c-1e5a-2fd16c84e7f4\",\"longcode\":\"Win payout if EUR/USD is strictly higher than entry spot at 3 minutes after contract start time.\","
+        "\"payout\":\"18.45\",\"spot\":\"1.13456\",\"spot_time\":1546000000}}",
+};
+
+int main() {
+        const int NUM_PASSES = 100000;
+        const size_t num_messages = NUM_PASSES * frames.size();
+
+        // разбор с построением json, как это было раньше
+        double check_sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int n = 0; n < NUM_PASSES; ++n) {
+                for(size_t i = 0; i < frames.size(); ++i) {
+                        json j = json::parse(frames[i]);
+                        json::iterator it_msg_type = j.find("msg_type");
+                        if(*it_msg_type == "tick") {
+                                check_sum += atof((j["tick"]["quote"].get<std::string>()).c_str());
+                        } else
+                        if(*it_msg_type == "ohlc") {
+                                check_sum += atof((j["ohlc"]["close"].get<std::string>()).c_str());
+                        } else
+                        if(*it_msg_type == "proposal") {
+                                check_sum += atof((j["proposal"]["payout"].get<std::string>()).c_str());
+                        }
+                }
+        }
+        auto stop = std::chrono::steady_clock::now();
+        const double dom_time = std::chrono::duration<double>(stop - start).count();
+        std::cout << "json (DOM): " << (num_messages / dom_time) << " messages/sec, check sum " << check_sum << std::endl;
+
+        // потоковый разбор
+        check_sum = 0;
+        BinaryAPI::FastMessage msg;
+        start = std::chrono::steady_clock::now();
+        for(int n = 0; n < NUM_PASSES; ++n) {
+                for(size_t i = 0; i < frames.size(); ++i) {
+                        BinaryAPI::parse_fast_message(frames[i], msg);
+                        check_sum += msg.msg_type == "proposal" ? msg.payout : msg.quote;
+                }
+        }
+        stop = std::chrono::steady_clock::now();
+        const double sax_time = std::chrono::duration<double>(stop - start).count();
+        std::cout << "fast (SAX): " << (num_messages / sax_time) << " messages/sec, check sum " << check_sum << std::endl;
+        std::cout << "speedup: " << (dom_time / sax_time) << std::endl;
+
+        // ответ history на 5000 тиков
+        const int NUM_TICKS = 5000;
+        json j_history;
+        j_history["msg_type"] = "history";
+        for(int i = 0; i < NUM_TICKS; ++i) {
+                j_history["history"]["prices"].push_back(std::to_string(1.13456 + i * 0.00001));
+                j_history["history"]["times"].push_back(std::to_string(1546000000 + i));
+        }
+        const int NUM_DECODES = 200;
+
+        // преобразование через временные строки, как это было раньше
+        check_sum = 0;
+        start = std::chrono::steady_clock::now();
+        for(int n = 0; n < NUM_DECODES; ++n) {
+                json &j_prices = j_history["history"]["prices"];
+                json &j_times = j_history["history"]["times"];
+                std::vector<double> prices(j_prices.size());
+                std::vector<unsigned long long> times(j_times.size());
+                for(size_t i = 0; i < prices.size(); i++) {
+                        prices[i] = atof((j_prices[i].get<std::string>()).c_str());
+                        times[i] = atoi((j_times[i].get<std::string>()).c_str());
+                }
+                check_sum += prices.back() + times.back();
+        }
+        stop = std::chrono::steady_clock::now();
+        const double atof_time = std::chrono::duration<double>(stop - start).count();
+        std::cout << "history decode (atof): " << (1000.0 * atof_time / NUM_DECODES) << " ms per " << NUM_TICKS << " ticks, check sum " << check_sum << std::endl;
+
+        // преобразование без временных строк
+        check_sum = 0;
+        start = std::chrono::steady_clock::now();
+        for(int n = 0; n < NUM_DECODES; ++n) {
+                std::vector<double> prices;
+                std::vector<unsigned long long> times;
+                BinaryAPI::parse_ticks_history(j_history, prices, times);
+                check_sum += prices.back() + times.back();
+        }
+        stop = std::chrono::steady_clock::now();
+        const double parse_time = std::chrono::duration<double>(stop - start).count();
+        std::cout << "history decode (parse_number): " << (1000.0 * parse_time / NUM_DECODES) << " ms per " << NUM_TICKS << " ticks, check sum " << check_sum << std::endl;
+        std::cout << "speedup: " << (atof_time / parse_time) << std::endl;
+        return 0;
+}
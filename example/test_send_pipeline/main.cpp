@@ -0,0 +1,61 @@
+#include <iostream>
+#include <ctime>
+#include "BinaryAPI.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/** \brief Получить процессорное время процесса в секундах
+ */
+double get_cpu_time()
+{
+#ifdef _WIN32
+        FILETIME creation_time, exit_time, kernel_time, user_time;
+        if(!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+                return 0.0;
+        ULARGE_INTEGER kernel, user;
+        kernel.LowPart = kernel_time.dwLowDateTime;
+        kernel.HighPart = kernel_time.dwHighDateTime;
+        user.LowPart = user_time.dwLowDateTime;
+        user.HighPart = user_time.dwHighDateTime;
+        return (double)(kernel.QuadPart + user.QuadPart) * 1.0e-7;
+#else
+        return (double)std::clock() / (double)CLOCKS_PER_SEC;
+#endif
+}
+
+int main() {
+        BinaryAPI iBinaryApi;
+
+        // проверим загрузку процессора в режиме простоя
+        const int IDLE_SECONDS = 10;
+        std::cout << "idle " << IDLE_SECONDS << " seconds..." << std::endl;
+        const double cpu_start = get_cpu_time();
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::seconds(IDLE_SECONDS));
+        const double cpu_stop = get_cpu_time();
+        auto stop = std::chrono::steady_clock::now();
+        const double wall_time = std::chrono::duration<double>(stop - start).count();
+        std::cout << "idle cpu usage: " << (100.0 * (cpu_stop - cpu_start) / wall_time) << " %" << std::endl;
+
+        // проверим задержку отправки сообщений (запрос времени сервера)
+        const int NUM_REQUESTS = 20;
+        double sum_latency = 0.0;
+        double max_latency = 0.0;
+        unsigned long long servertime = 0;
+        iBinaryApi.get_servertime(servertime); // сбросим флаг времени сервера
+        for(int i = 0; i < NUM_REQUESTS; ++i) {
+                auto t1 = std::chrono::steady_clock::now();
+                iBinaryApi.request_servertime();
+                while(iBinaryApi.get_servertime(servertime) != iBinaryApi.OK) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                auto t2 = std::chrono::steady_clock::now();
+                const double latency = std::chrono::duration<double, std::milli>(t2 - t1).count();
+                sum_latency += latency;
+                max_latency = std::max(max_latency, latency);
+        }
+        std::cout << "round trip (time): mean " << (sum_latency / NUM_REQUESTS) <<
+                " ms, max " << max_latency << " ms" << std::endl;
+        return 0;
+}
@@ -0,0 +1,47 @@
+#include <iostream>
+#include "BinaryAPI.hpp"
+
+int main() {
+        BinaryAPI iBinaryApi;
+        std::vector<std::string> symbols;
+        symbols.push_back("R_10");
+        symbols.push_back("R_25");
+        symbols.push_back("R_50");
+        symbols.push_back("R_100");
+        iBinaryApi.init_symbols(symbols);
+
+        // обработчики вызываются из потока соединения сразу после получения сообщения
+        iBinaryApi.on_tick = [&](const size_t /*indx*/,
+                                 const std::string &symbol,
+                                 const unsigned long long epoch,
+                                 const double quote) {
+                std::cout << "tick " << symbol << " " << quote << " " << epoch << std::endl;
+        };
+        iBinaryApi.on_candle_close = [&](const size_t /*indx*/,
+                                         const std::string &symbol,
+                                         const BinaryAPI::QuotationBar &bar) {
+                std::cout << "candle " << symbol << " " << bar.close << " " << bar.timestamp << std::endl;
+        };
+        iBinaryApi.on_proposal = [&](const size_t /*indx*/,
+                                     const std::string &symbol,
+                                     const std::string &contract_type,
+                                     const double payout_ratio) {
+                std::cout << "proposal " << symbol << " " << contract_type << " " << payout_ratio << std::endl;
+        };
+
+        std::cout << "init_stream_quotations " << iBinaryApi.init_stream_quotations(60) << std::endl;
+        std::cout << "init_stream_proposal " << iBinaryApi.init_stream_proposal(10, 3, iBinaryApi.MINUTES, "USD") << std::endl;
+
+        const char *names[] = {"on_tick", "on_candle_close", "on_proposal"};
+        while(true) {
+                std::this_thread::sleep_for(std::chrono::seconds(10));
+                // задержка от получения сообщения до возврата из обработчика
+                for(int i = 0; i < BinaryAPI::DISPATCH_TYPES_NUM; ++i) {
+                        BinaryAPI::DispatchLatency latency;
+                        iBinaryApi.get_dispatch_latency(i, latency);
+                        std::cout << names[i] << ": count " << latency.count <<
+                                " mean " << latency.mean << " us max " << latency.max <<
+                                " us last " << latency.last << " us" << std::endl;
+                }
+        }
+}
@@ -29,15 +29,118 @@
 #include <xtime.hpp>
 #include <thread>
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <cmath>
+#include <memory>
+#include <type_traits>
 #include <vector>
+#include <algorithm>
+#include <array>
+#include <map>
 #include <queue>
+#include <deque>
 #include <atomic>
 #include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include <fstream>
 #include <iostream>
 //------------------------------------------------------------------------------
 #define BINARY_API_USE_TICKS_HISTORY_SUBSCRIBE 1
 #define BINARY_API_LOG_FILE_NAME "binary_api_log_errors.txt"
+#define BINARY_API_MAX_REQUESTS_PER_MINUTE 180
+#define BINARY_API_MAX_HISTORY_REQUESTS_PER_MINUTE 120  // доля лимита запросов для загрузки истории
+#define BINARY_API_MIN_REQUESTS_PER_MINUTE 10           // нижняя граница подстройки лимита запросов после ошибок RateLimit
+#define BINARY_API_PROPOSAL_REQUESTS_PER_MINUTE 25      // начальный лимит подписок на проценты выплат
+#define BINARY_API_RATE_LIMIT_HOLD_SECONDS 60           // время после ошибки RateLimit, в течение которого лимит не растет
+#define BINARY_API_SLOW_RESPONSE_MS 500                 // задержка ответа, начиная с которой сервер считается перегруженным
+#ifndef BINARY_API_PROCESS_REQUESTS_PER_MINUTE
+#define BINARY_API_PROCESS_REQUESTS_PER_MINUTE BINARY_API_MAX_REQUESTS_PER_MINUTE // общий лимит запросов всех объектов процесса
+#endif
+#define BINARY_API_LOG_QUEUE_SIZE 4096                  // максимальное число строк лога в очереди (степень двойки)
+#define BINARY_API_LOG_MAX_FILE_SIZE (16*1024*1024)     // размер файла лога, после которого он переименовывается
+#define BINARY_API_LOG_MAX_FILES 3                      // количество хранимых старых файлов лога
+#ifndef BINARY_API_STREAM_QUOTATIONS_CAPACITY
+#define BINARY_API_STREAM_QUOTATIONS_CAPACITY 10080 // минутных баров на символ (неделя)
+#endif
+#ifndef BINARY_API_AGGREGATOR_CAPACITY
+#define BINARY_API_AGGREGATOR_CAPACITY 1440 // баров каждого периода агрегатора тиков на символ
+#endif
+#define BINARY_API_SERVER_CLOCK_WANDER 50e-6          // возможный уход локальных часов относительно часов сервера (секунд в секунду)
+#define BINARY_API_SERVER_CLOCK_MAX_DRIFT 200e-6        // ограничение оценки ухода часов
+#define BINARY_API_SERVER_CLOCK_MAX_ERROR 0.25          // погрешность оценки времени сервера, после которой время запрашивается снова (секунды)
+#define BINARY_API_SERVER_CLOCK_SAMPLES 64              // число ответов time для оценки ухода часов
+#ifndef BINARY_API_PAYOUT_HISTORY_CAPACITY
+#define BINARY_API_PAYOUT_HISTORY_CAPACITY 3600 // значений процентов выплат на символ и направление (час)
+#endif
+//------------------------------------------------------------------------------
+#ifdef USE_STANDALONE_ASIO
+namespace binary_api_asio = ::asio;
+#else
+namespace binary_api_asio = boost::asio;
+#endif
+//------------------------------------------------------------------------------
+/** \brief Общий цикл событий для нескольких объектов BinaryAPI
+ * Соединения всех объектов BinaryAPI, созданных с этим циклом событий, обслуживаются
+ * фиксированным набором потоков. Очереди сообщений и ограничение числа запросов
+ * работают на таймерах цикла событий, поэтому такие объекты BinaryAPI не создают своих потоков.
+ * Цикл событий должен быть удален после всех объектов BinaryAPI, которые его используют
+ */
+class BinaryApiEventLoop
+{
+public:
+        using IoService = binary_api_asio::io_service;
+private:
+        std::shared_ptr<IoService> io_service_;
+        std::unique_ptr<IoService::work> work_; // не дает циклу событий завершиться без соединений
+        std::vector<std::thread> threads_;
+public:
+        /** \brief Запустить цикл событий
+         * \param threads_num Количество потоков цикла событий
+         */
+        explicit BinaryApiEventLoop(const size_t threads_num = 1) :
+                io_service_(std::make_shared<IoService>()),
+                work_(new IoService::work(*io_service_)) {
+                for(size_t i = 0; i < std::max(threads_num, (size_t)1); ++i) {
+                        threads_.emplace_back([&]() {
+                                while(true) {
+                                        try {
+                                                io_service_->run();
+                                                break;
+                                        }
+                                        catch(std::exception &e) {
+                                                std::cout << "BinaryApiEventLoop: Error, error message: " << e.what() << std::endl;
+                                        }
+                                        catch(...) {
+                                                std::cout << "BinaryApiEventLoop: Error" << std::endl;
+                                        }
+                                }
+                        });
+                }
+        };
+
+        ~BinaryApiEventLoop()
+        {
+                work_.reset();
+                io_service_->stop();
+                for(size_t i = 0; i < threads_.size(); ++i) {
+                        if(threads_[i].joinable()) threads_[i].join();
+                }
+        }
+
+        /// Получить цикл событий asio
+        inline std::shared_ptr<IoService> get_io_service() const {return io_service_;}
+
+        /// Получить количество потоков цикла событий
+        inline size_t get_threads_num() const {return threads_.size();}
+};
 //------------------------------------------------------------------------------
 class BinaryAPI
 {
@@ -72,9 +175,608 @@ public:
                 HOURS = 3,                      ///< Часы
                 DAYS = 4,                       ///< Дни
         };
+//------------------------------------------------------------------------------
+        /// Режимы создания объекта
+        enum ConnectMode {
+                WAIT_CONNECTION = 0,            ///< Конструктор ждет соединения и авторизации
+                ASYNC_CONNECTION,               ///< Конструктор не ждет соединения (см. wait_ready, wait_ready_async)
+        };
+//------------------------------------------------------------------------------
+        /** \brief Приоритеты очереди отправки сообщений
+         * Сообщения с меньшим значением отправляются первыми. Для каждого приоритета
+         * задается своя доля общего лимита запросов (см. set_send_budget)
+         */
+        enum SendPriority {
+                SEND_ORDER = 0,                 ///< Открытие и закрытие сделок (buy, sell)
+                SEND_SUBSCRIPTION,              ///< Подписки и прочие запросы
+                SEND_PING,                      ///< ping
+                SEND_HISTORY,                   ///< Загрузка истории (ticks_history без подписки)
+                SEND_PRIORITIES_NUM,
+        };
+//------------------------------------------------------------------------------
+        /// Типы сообщений сервера
+        enum MessageType {
+                MSG_UNKNOWN = 0,                ///< Неизвестный тип сообщения
+                MSG_TICK,                       ///< tick
+                MSG_OHLC,                       ///< ohlc
+                MSG_PROPOSAL,                   ///< proposal
+                MSG_CANDLES,                    ///< candles
+                MSG_HISTORY,                    ///< history
+                MSG_TIME,                       ///< time
+                MSG_AUTHORIZE,                  ///< authorize
+                MSG_BUY,                        ///< buy
+                MSG_SELL,                       ///< sell
+                MSG_PROPOSAL_OPEN_CONTRACT,     ///< proposal_open_contract
+                MSG_BALANCE,                    ///< balance
+                MSG_TRANSACTION,                ///< transaction
+                MSG_PORTFOLIO,                  ///< portfolio
+                MSG_PING,                       ///< ping
+                MSG_FORGET,                     ///< forget
+                MSG_FORGET_ALL,                 ///< forget_all
+                MSG_ACTIVE_SYMBOLS,             ///< active_symbols
+                MSG_TYPES_NUM,                  ///< Число встроенных типов сообщений
+        };
+//------------------------------------------------------------------------------
+        /** \brief Данные часто приходящих сообщений (tick, ohlc, proposal)
+         * Поля заполняются потоковым разбором сообщения без построения json
+         */
+        class FastMessage {
+        public:
+                std::string msg_type;           ///< Тип сообщения
+                std::string symbol;             ///< Символ (tick.symbol, ohlc.symbol или echo_req.symbol)
+                std::string contract_type;      ///< Тип контракта из echo_req (для proposal)
+                std::string error_code;         ///< Код ошибки error.code
+                std::string proposal_id;        ///< Идентификатор предложения (proposal.id)
+                unsigned long long epoch = 0;   ///< Время тика (tick.epoch, ohlc.epoch или proposal.spot_time)
+                unsigned long long open_time = 0;       ///< Время открытия свечи (ohlc.open_time)
+                double quote = 0;               ///< Цена (tick.quote или ohlc.close)
+                double open = 0;                ///< Цена открытия свечи (ohlc.open)
+                double high = 0;                ///< Максимальная цена свечи (ohlc.high)
+                double low = 0;                 ///< Минимальная цена свечи (ohlc.low)
+                double ask_price = 0;           ///< Размер ставки (proposal.ask_price)
+                double payout = 0;              ///< Размер выплаты (proposal.payout)
+                int subscribe = 0;              ///< Флаг подписки из echo_req
+                bool is_error = false;          ///< Сообщение содержит ошибку
+
+                /// Очистить данные, сохранив выделенную под строки память
+                void clear()
+                {
+                        msg_type.clear();
+                        symbol.clear();
+                        contract_type.clear();
+                        error_code.clear();
+                        proposal_id.clear();
+                        epoch = open_time = 0;
+                        quote = open = high = low = ask_price = payout = 0;
+                        subscribe = 0;
+                        is_error = false;
+                }
+        };
+//------------------------------------------------------------------------------
+        /** \brief Кольцевой буфер фиксированного размера (один писатель, много читателей)
+         * Запись не блокируется читателями: согласованность данных обеспечивает
+         * счетчик последовательности (seqlock). Читатель повторяет чтение,
+         * если во время копирования данные были изменены.
+         * Элементы адресуются абсолютным индексом, который растет с каждым push.
+         * Данные хранятся по полям (struct-of-arrays): каждое 8-байтовое поле T
+         * лежит в своем массиве, поэтому одно поле всех элементов копируется подряд.
+         * Тип T должен быть тривиально копируемым, размер кратен 8 байтам
+         */
+        template <class T>
+        class RingBuffer {
+        private:
+                static_assert(std::is_trivially_copyable<T>::value, "RingBuffer: T must be trivially copyable");
+                static_assert(sizeof(T) % sizeof(uint64_t) == 0, "RingBuffer: sizeof(T) must be a multiple of 8");
+                static const size_t WORDS = sizeof(T) / sizeof(uint64_t);
+
+                size_t capacity_;
+                std::unique_ptr<std::atomic<uint64_t>[]> data_;
+                std::atomic<uint64_t> sequence_;        // нечетное значение - идет запись
+                std::atomic<unsigned long long> begin_; // индекс первого элемента
+                std::atomic<unsigned long long> head_;  // индекс после последнего элемента
+
+                inline void store_slot(const unsigned long long index, const T &value)
+                {
+                        uint64_t words[WORDS];
+                        std::memcpy(words, &value, sizeof(T));
+                        std::atomic<uint64_t> *slot = &data_[index % capacity_];
+                        for(size_t w = 0; w < WORDS; ++w) {
+                                slot[w * capacity_].store(words[w], std::memory_order_relaxed);
+                        }
+                }
+
+                inline void load_slot(const unsigned long long index, T &value) const
+                {
+                        uint64_t words[WORDS];
+                        const std::atomic<uint64_t> *slot = &data_[index % capacity_];
+                        for(size_t w = 0; w < WORDS; ++w) {
+                                words[w] = slot[w * capacity_].load(std::memory_order_relaxed);
+                        }
+                        std::memcpy(&value, words, sizeof(T));
+                }
+
+                inline void begin_write()
+                {
+                        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_release);
+                }
+
+                inline void end_write()
+                {
+                        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                }
+
+                inline uint64_t begin_read() const
+                {
+                        while(true) {
+                                const uint64_t seq = sequence_.load(std::memory_order_acquire);
+                                if((seq & 1) == 0) return seq;
+                                std::this_thread::yield();
+                        }
+                }
+
+                inline bool end_read(const uint64_t seq) const
+                {
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        return sequence_.load(std::memory_order_relaxed) == seq;
+                }
+
+                template <class V>
+                void load_field(const size_t field,
+                                const unsigned long long begin,
+                                const size_t size,
+                                std::vector<V> &values) const
+                {
+                        static_assert(sizeof(V) == sizeof(uint64_t), "RingBuffer: field type must be 8 bytes");
+                        values.resize(size);
+                        const std::atomic<uint64_t> *column = &data_[field * capacity_];
+                        for(size_t i = 0; i < size; ++i) {
+                                const uint64_t word = column[(begin + i) % capacity_].load(std::memory_order_relaxed);
+                                std::memcpy(&values[i], &word, sizeof(uint64_t));
+                        }
+                }
+        public:
+                /** \brief Курсор чтения новых элементов
+                 * Хранит позицию читателя между вызовами read_new
+                 */
+                class Cursor {
+                private:
+                        friend class RingBuffer;
+                        unsigned long long index_ = 0;  // индекс следующего непрочитанного элемента
+                        uint64_t version_ = 0;          // версия буфера при последнем чтении
+                        T last_;                        // последний прочитанный элемент
+                        bool is_last_ = false;
+                public:
+                        /// Индекс следующего непрочитанного элемента
+                        inline unsigned long long index() const {return index_;}
+                };
+
+                explicit RingBuffer(const size_t capacity) :
+                        capacity_(std::max(capacity, (size_t)1)),
+                        data_(new std::atomic<uint64_t>[capacity_ * WORDS]),
+                        sequence_(0), begin_(0), head_(0) {
+                        for(size_t i = 0; i < capacity_ * WORDS; ++i) {
+                                data_[i].store(0, std::memory_order_relaxed);
+                        }
+                };
+
+                /// Максимальное число элементов
+                inline size_t capacity() const {return capacity_;}
+
+                /** \brief Добавить элемент (только поток-писатель)
+                 * Если буфер заполнен, самый старый элемент вытесняется
+                 */
+                void push(const T &value)
+                {
+                        const unsigned long long head = head_.load(std::memory_order_relaxed);
+                        begin_write();
+                        store_slot(head, value);
+                        if(head + 1 - begin_.load(std::memory_order_relaxed) > capacity_) {
+                                begin_.store(head + 1 - capacity_, std::memory_order_relaxed);
+                        }
+                        head_.store(head + 1, std::memory_order_relaxed);
+                        end_write();
+                }
+
+                /** \brief Заменить последний элемент (только поток-писатель)
+                 * Если буфер пуст, элемент будет добавлен
+                 */
+                void update_back(const T &value)
+                {
+                        const unsigned long long head = head_.load(std::memory_order_relaxed);
+                        if(head == begin_.load(std::memory_order_relaxed)) {
+                                push(value);
+                                return;
+                        }
+                        begin_write();
+                        store_slot(head - 1, value);
+                        end_write();
+                }
+
+                /** \brief Заменить содержимое буфера (только поток-писатель)
+                 * Если элементов больше емкости, сохраняются последние
+                 * \param values Массив элементов
+                 * \param size Количество элементов
+                 */
+                void assign(const T *values, const size_t size)
+                {
+                        const size_t offset = size > capacity_ ? size - capacity_ : 0;
+                        const unsigned long long begin = head_.load(std::memory_order_relaxed);
+                        begin_write();
+                        for(size_t i = offset; i < size; ++i) {
+                                store_slot(begin + (i - offset), values[i]);
+                        }
+                        begin_.store(begin, std::memory_order_relaxed);
+                        head_.store(begin + (size - offset), std::memory_order_relaxed);
+                        end_write();
+                }
+
+                /// Удалить все элементы (только поток-писатель)
+                void clear()
+                {
+                        begin_write();
+                        begin_.store(head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                        end_write();
+                }
+
+                /** \brief Номер версии данных
+                 * Меняется при каждом изменении буфера
+                 */
+                inline uint64_t version() const
+                {
+                        return sequence_.load(std::memory_order_acquire);
+                }
+
+                /// Индекс первого элемента
+                inline unsigned long long begin() const {return begin_.load(std::memory_order_acquire);}
+
+                /// Индекс после последнего элемента
+                inline unsigned long long end() const {return head_.load(std::memory_order_acquire);}
+
+                /// Количество элементов
+                inline size_t size() const
+                {
+                        while(true) {
+                                const uint64_t seq = begin_read();
+                                const size_t size = head_.load(std::memory_order_relaxed) - begin_.load(std::memory_order_relaxed);
+                                if(end_read(seq)) return size;
+                        }
+                }
+
+                /** \brief Прочитать элемент по абсолютному индексу
+                 * \param index Индекс элемента
+                 * \param value Элемент
+                 * \return вернет false, если элемент уже вытеснен или еще не записан
+                 */
+                bool read(const unsigned long long index, T &value) const
+                {
+                        while(true) {
+                                const uint64_t seq = begin_read();
+                                const unsigned long long begin = begin_.load(std::memory_order_relaxed);
+                                const unsigned long long head = head_.load(std::memory_order_relaxed);
+                                const bool is_valid = index >= begin && index < head;
+                                if(is_valid) load_slot(index, value);
+                                if(end_read(seq)) return is_valid;
+                        }
+                }
+
+                /** \brief Прочитать последний элемент
+                 * \param value Элемент
+                 * \return вернет false, если буфер пуст
+                 */
+                bool back(T &value) const
+                {
+                        while(true) {
+                                const uint64_t seq = begin_read();
+                                const unsigned long long begin = begin_.load(std::memory_order_relaxed);
+                                const unsigned long long head = head_.load(std::memory_order_relaxed);
+                                const bool is_valid = head > begin;
+                                if(is_valid) load_slot(head - 1, value);
+                                if(end_read(seq)) return is_valid;
+                        }
+                }
+
+                /** \brief Прочитать элементы, добавленные или измененные после прошлого чтения
+                 * Память не выделяется, каждый элемент передается в функцию func.
+                 * Если читатель отстал больше, чем на емкость буфера, вытесненные элементы пропускаются
+                 * \param cursor Курсор читателя
+                 * \param func Функция вида void(const T &value, const bool is_update),
+                 * is_update равен true, если это повторно переданный и измененный последний элемент
+                 * \return количество переданных элементов
+                 */
+                template <class FUNC_TYPE>
+                size_t read_new(Cursor &cursor, FUNC_TYPE func) const
+                {
+                        const uint64_t version = sequence_.load(std::memory_order_acquire);
+                        if(version == cursor.version_) return 0;
+                        if(cursor.index_ > end()) cursor = Cursor(); // буфер был создан заново
+
+                        size_t num = 0;
+                        T value;
+                        if(cursor.is_last_ && read(cursor.index_ - 1, value) &&
+                                std::memcmp(&value, &cursor.last_, sizeof(T)) != 0) {
+                                cursor.last_ = value;
+                                func(value, true);
+                                ++num;
+                        }
+                        while(true) {
+                                const unsigned long long begin = this->begin();
+                                if(cursor.index_ < begin) cursor.index_ = begin;
+                                if(cursor.index_ >= end()) break;
+                                if(!read(cursor.index_, value)) continue; // элемент вытеснен, начинаем с нового begin
+                                ++cursor.index_;
+                                cursor.last_ = value;
+                                cursor.is_last_ = true;
+                                func(value, false);
+                                ++num;
+                        }
+                        cursor.version_ = version;
+                        return num;
+                }
+
+                /** \brief Скопировать все элементы
+                 * \param values Массив элементов
+                 */
+                void copy(std::vector<T> &values) const
+                {
+                        while(true) {
+                                const uint64_t seq = begin_read();
+                                const unsigned long long begin = begin_.load(std::memory_order_relaxed);
+                                const unsigned long long head = head_.load(std::memory_order_relaxed);
+                                const size_t size = std::min((size_t)(head - begin), capacity_);
+                                values.resize(size);
+                                for(size_t i = 0; i < size; ++i) {
+                                        load_slot(begin + i, values[i]);
+                                }
+                                if(end_read(seq)) return;
+                        }
+                }
+
+                /** \brief Скопировать все элементы по полям (struct-of-arrays)
+                 * Количество массивов равно числу 8-байтовых полей T, порядок - как в T
+                 * \param fields Массивы полей (double, unsigned long long и т.п.)
+                 */
+                template <class... V>
+                void copy_fields(std::vector<V> &... fields) const
+                {
+                        static_assert(sizeof...(V) == WORDS, "RingBuffer: one array per field is required");
+                        while(true) {
+                                const uint64_t seq = begin_read();
+                                const unsigned long long begin = begin_.load(std::memory_order_relaxed);
+                                const unsigned long long head = head_.load(std::memory_order_relaxed);
+                                const size_t size = std::min((size_t)(head - begin), capacity_);
+                                size_t field = 0;
+                                int expand[] = {(load_field(field++, begin, size, fields), 0)...};
+                                (void)expand;
+                                if(end_read(seq)) return;
+                        }
+                }
+        };
+//------------------------------------------------------------------------------
+        /** \brief Минутный бар потока котировок
+         * Поля open, high и low добавлены после close, чтобы не менять порядок прежних полей
+         */
+        struct QuotationBar {
+                unsigned long long timestamp;   ///< Время открытия бара
+                double close;                   ///< Цена закрытия бара
+                double open;                    ///< Цена открытия бара
+                double high;                    ///< Максимальная цена бара
+                double low;                     ///< Минимальная цена бара
+        };
+//------------------------------------------------------------------------------
+        /// Минутные бары потока котировок по полям (struct-of-arrays)
+        class QuotationColumns {
+        public:
+                std::vector<unsigned long long> timestamp;      ///< Время открытия баров
+                std::vector<double> open;                       ///< Цены открытия
+                std::vector<double> high;                       ///< Максимальные цены
+                std::vector<double> low;                        ///< Минимальные цены
+                std::vector<double> close;                      ///< Цены закрытия
+        };
+//------------------------------------------------------------------------------
+        /// Бар агрегатора тиков
+        struct CandleBar {
+                unsigned long long timestamp;   ///< Время открытия бара
+                double open;                    ///< Цена открытия
+                double high;                    ///< Максимальная цена
+                double low;                     ///< Минимальная цена
+                double close;                   ///< Цена закрытия
+                unsigned long long ticks;       ///< Количество тиков
+        };
+//------------------------------------------------------------------------------
+        /// Бары агрегатора тиков по полям (struct-of-arrays)
+        class CandleColumns {
+        public:
+                std::vector<unsigned long long> timestamp;      ///< Время открытия баров
+                std::vector<double> open;                       ///< Цены открытия
+                std::vector<double> high;                       ///< Максимальные цены
+                std::vector<double> low;                        ///< Минимальные цены
+                std::vector<double> close;                      ///< Цены закрытия
+                std::vector<unsigned long long> ticks;          ///< Количество тиков
+        };
+//------------------------------------------------------------------------------
+        /// Значение потока процентов выплат
+        struct PayoutPoint {
+                unsigned long long timestamp;   ///< Время сервера (proposal.spot_time)
+                double payout;                  ///< Процент выплат
+        };
+//------------------------------------------------------------------------------
+        /// Курсор чтения новых баров потока котировок одной валютной пары
+        using QuotationCursor = RingBuffer<QuotationBar>::Cursor;
+//------------------------------------------------------------------------------
+        /// Типы событий потоков, передаваемых в обработчики on_tick, on_candle_close и on_proposal
+        enum DispatchType {
+                DISPATCH_TICK = 0,              ///< on_tick
+                DISPATCH_CANDLE_CLOSE,          ///< on_candle_close
+                DISPATCH_PROPOSAL,              ///< on_proposal
+                DISPATCH_TYPES_NUM,
+        };
+//------------------------------------------------------------------------------
+        /** \brief Статистика задержки обработчиков событий
+         * Задержка измеряется от получения сообщения до возврата из обработчика
+         */
+        class DispatchLatency {
+        public:
+                unsigned long long count = 0;   ///< Количество вызовов обработчика
+                double mean = 0;                ///< Средняя задержка (мкс)
+                double max = 0;                 ///< Максимальная задержка (мкс)
+                double last = 0;                ///< Задержка последнего вызова (мкс)
+        };
+//------------------------------------------------------------------------------
+        /// Результат открытия сделки по предложению (см. send_order_by_proposal)
+        class OrderResult {
+        public:
+                int error = OK;                         ///< Состояние ошибки (см. ErrorType)
+                std::string error_code;                 ///< Код ошибки сервера (error.code)
+                std::string error_message;              ///< Сообщение об ошибке сервера
+                unsigned long long contract_id = 0;     ///< Номер контракта
+                unsigned long long transaction_id = 0;  ///< Номер транзакции
+                double buy_price = 0;                   ///< Цена покупки контракта
+                double payout = 0;                      ///< Размер выплаты
+                unsigned long long latency = 0;         ///< Задержка от отправки запроса до ответа сервера (мкс)
+        };
+//------------------------------------------------------------------------------
+        /** \brief Гистограмма задержек (мкс)
+         * Как в HdrHistogram, интервалы растут по степеням двойки и делятся на 16 частей,
+         * поэтому относительная погрешность процентилей не превышает 1/16
+         */
+        class LatencyHistogram {
+        public:
+                static const int SUB_BUCKETS = 16;                      ///< Число интервалов на степень двойки
+                static const int BUCKETS = 38 * SUB_BUCKETS;            ///< Число интервалов (до 2^41 мкс)
+        private:
+                std::array<unsigned long long, BUCKETS> counts_;
+                unsigned long long count_ = 0;
+                unsigned long long sum_ = 0;
+                unsigned long long min_ = 0;
+                unsigned long long max_ = 0;
+
+                static int get_index(const unsigned long long value)
+                {
+                        if(value < SUB_BUCKETS) return (int)value;
+                        int msb = 0;
+                        unsigned long long temp = value;
+                        while(temp >>= 1) ++msb;
+                        // старшие 5 бит значения: степень двойки и номер части интервала
+                        const int index = (msb - 3) * SUB_BUCKETS + (int)(value >> (msb - 4)) - SUB_BUCKETS;
+                        return std::min(index, BUCKETS - 1);
+                }
+
+                static unsigned long long get_upper_value(const int index)
+                {
+                        if(index < SUB_BUCKETS) return index;
+                        const int shift = index / SUB_BUCKETS - 1;
+                        const unsigned long long top = index % SUB_BUCKETS + SUB_BUCKETS;
+                        return ((top + 1) << shift) - 1;
+                }
+        public:
+                LatencyHistogram()
+                {
+                        counts_.fill(0);
+                }
+
+                /** \brief Добавить значение
+                 * \param value Задержка (мкс)
+                 */
+                void add(const unsigned long long value)
+                {
+                        ++counts_[get_index(value)];
+                        if(count_ == 0 || value < min_) min_ = value;
+                        if(value > max_) max_ = value;
+                        sum_ += value;
+                        ++count_;
+                }
+
+                /// Очистить гистограмму
+                void clear()
+                {
+                        counts_.fill(0);
+                        count_ = sum_ = min_ = max_ = 0;
+                }
+
+                /// Количество значений
+                inline unsigned long long get_count() const {return count_;}
+                /// Минимальная задержка (мкс)
+                inline unsigned long long get_min() const {return min_;}
+                /// Максимальная задержка (мкс)
+                inline unsigned long long get_max() const {return max_;}
+                /// Средняя задержка (мкс)
+                inline double get_mean() const {return count_ > 0 ? (double)sum_ / (double)count_ : 0.0;}
+
+                /** \brief Получить процентиль задержки
+                 * \param percent Процент значений (от 0 до 100), которые не превышают результат
+                 * \return задержка (мкс)
+                 */
+                unsigned long long get_percentile(const double percent) const
+                {
+                        if(count_ == 0) return 0;
+                        unsigned long long target = (unsigned long long)(percent / 100.0 * (double)count_ + 0.5);
+                        target = std::max(target, 1ULL);
+                        unsigned long long total = 0;
+                        for(int i = 0; i < BUCKETS; ++i) {
+                                total += counts_[i];
+                                if(total >= target) return std::min(get_upper_value(i), max_);
+                        }
+                        return max_;
+                }
+        };
+//------------------------------------------------------------------------------
+        /** \brief Статистика задержек запросов
+         * Время запроса отсчитывается от постановки в очередь отправки, отправки и получения ответа
+         */
+        class LatencyStats {
+        public:
+                std::map<std::string, LatencyHistogram> round_trip;     ///< От отправки запроса до ответа, по msg_type ответа
+                LatencyHistogram queue_wait;                            ///< Ожидание в очереди отправки
+                LatencyHistogram limiter_stall;                         ///< Простои очереди из-за ограничения числа запросов
+        };
+//------------------------------------------------------------------------------
+        /// Расход общего лимита запросов процесса одним объектом BinaryAPI (см. get_process_budget_usage)
+        class BudgetUsage {
+        public:
+                std::string name;                                               ///< Имя объекта (см. set_budget_name)
+                std::array<unsigned long long, SEND_PRIORITIES_NUM> consumed;   ///< Отправлено запросов по приоритетам (см. SendPriority)
+                unsigned long long deferred = 0;                                ///< Сколько раз объект уступил токен другому объекту
+        };
+//------------------------------------------------------------------------------
+        /** \brief Обработчик новых тиков
+         * Вызывается из потока соединения сразу после обновления потока котировок.
+         * Параметры: номер валютной пары (см. init_symbols), символ, время тика и котировка.
+         * Обработчики on_tick, on_candle_close и on_proposal нужно установить
+         * до вызова init_stream_quotations или init_stream_proposal
+         */
+        std::function<void(const size_t indx,
+                           const std::string &symbol,
+                           const unsigned long long epoch,
+                           const double quote)> on_tick;
+
+        /** \brief Обработчик закрытия минутной свечи
+         * Вызывается из потока соединения, когда пришла котировка следующей свечи.
+         * Параметры: номер валютной пары, символ и закрытая свеча
+         */
+        std::function<void(const size_t indx,
+                           const std::string &symbol,
+                           const QuotationBar &bar)> on_candle_close;
+
+        /** \brief Обработчик обновления процентов выплат
+         * Вызывается из потока соединения.
+         * Параметры: номер валютной пары, символ, тип контракта (CALL или PUT) и процент выплат
+         */
+        std::function<void(const size_t indx,
+                           const std::string &symbol,
+                           const std::string &contract_type,
+                           const double payout_ratio)> on_proposal;
+
+        /** \brief Обработчик разрыва соединения
+         * Вызывается из потока соединения. После вызова объект попробует переподключиться.
+         * Присвоить обработчик напрямую можно только до подключения (например, при ASYNC_CONNECTION
+         * соединение уже устанавливается), иначе используйте set_disconnect_handler
+         */
+        std::function<void()> on_disconnect;
 //------------------------------------------------------------------------------
         std::string log_file_name = BINARY_API_LOG_FILE_NAME;
 private:
+        std::mutex disconnect_mutex_; // защищает on_disconnect
         WssClient client_; // Класс клиента
         std::shared_ptr<WssClient::Connection> save_connection_; // Соединение
         std::atomic<bool> is_open_connection_; // состояние соединения
@@ -83,505 +785,2545 @@ private:
         std::atomic<bool> is_error_token_;
         std::mutex connection_mutex_;
 
-        std::queue<std::string> send_queue_; // Очередь сообщений
-        std::mutex send_queue_mutex_;
+        /** \brief Ограничитель числа запросов (token bucket)
+         * Токены пополняются равномерно, не более capacity штук.
+         * Если токенов нет, check сообщает, сколько ждать до следующего токена
+         */
+        class TokenBucket {
+        protected:
+                double capacity_;       // максимальное число токенов
+                double rate_;           // скорость пополнения (токенов в секунду)
+                double tokens_;         // текущее число токенов
+                std::chrono::steady_clock::time_point last_time_;
+        public:
+                TokenBucket(const double capacity, const double rate) :
+                        capacity_(capacity), rate_(rate), tokens_(capacity),
+                        last_time_(std::chrono::steady_clock::now()) {};
 
-        // параметры счета
-        std::atomic<double> balance_; // Баланс счета
-        std::string currency_ = ""; // Валюта счета
-        std::atomic<bool> is_authorize_;
-        std::mutex authorize_mutex_;
+                /** \brief Проверить наличие токена, не забирая его
+                 * \param now Текущее время
+                 * \param wait Время до появления следующего токена, если токенов нет
+                 * \return вернет true, если токен есть
+                 */
+                bool check(const std::chrono::steady_clock::time_point now,
+                           std::chrono::steady_clock::duration &wait)
+                {
+                        const double dt = std::chrono::duration<double>(now - last_time_).count();
+                        if(dt > 0) {
+                                last_time_ = now;
+                                tokens_ = std::min(capacity_, tokens_ + dt * rate_);
+                        }
+                        if(tokens_ >= 1.0)
+                                return true;
+                        wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>((1.0 - tokens_) / rate_));
+                        return false;
+                }
 
+                /** \brief Забрать токен
+                 * Токенов может стать меньше нуля, если запрос уже отправлен в обход очереди
+                 */
+                inline void take()
+                {
+                        tokens_ -= 1.0;
+                }
 
-        // поток выплат и котировок
-        std::vector<std::string> symbols_;
-        std::unordered_map<std::string, int> map_symbol_;
-        std::mutex map_symbol_mutex_;
+                /// Получить число токенов на момент последней проверки
+                inline double get_tokens() const
+                {
+                        return tokens_;
+                }
+        };
 
-        std::vector<double> proposal_buy_;
-        std::vector<double> proposal_sell_;
-        std::mutex proposal_mutex_;
+        /** \brief Ограничитель запросов, подстраивающий лимит по ответам сервера (AIMD)
+         * После ошибки RateLimit лимит уменьшается вдвое (не чаще раза в секунду),
+         * а накопленные токены сгорают. Каждый успешный запрос увеличивает лимит на
+         * один запрос в минуту, но не раньше BINARY_API_RATE_LIMIT_HOLD_SECONDS после ошибки
+         */
+        class AdaptiveLimiter : public TokenBucket {
+        private:
+                double rate_per_minute_;        // текущий лимит (запросов в минуту)
+                double min_rate_;               // нижняя граница лимита
+                double max_rate_;               // верхняя граница лимита
+                bool is_decrease_;              // была ошибка RateLimit
+                std::chrono::steady_clock::time_point last_decrease_;
+
+                void set_rate(const double rate_per_minute)
+                {
+                        rate_per_minute_ = rate_per_minute;
+                        capacity_ = rate_per_minute;
+                        rate_ = rate_per_minute / 60.0;
+                        tokens_ = std::min(tokens_, capacity_);
+                }
+        public:
+                AdaptiveLimiter(const double rate_per_minute, const double min_rate, const double max_rate) :
+                        TokenBucket(rate_per_minute, rate_per_minute / 60.0),
+                        rate_per_minute_(rate_per_minute), min_rate_(min_rate), max_rate_(max_rate),
+                        is_decrease_(false) {};
+
+                /** \brief Уменьшить лимит после ошибки RateLimit
+                 * \param now Текущее время
+                 */
+                void decrease(const std::chrono::steady_clock::time_point now)
+                {
+                        // несколько ошибок подряд - ответ на одну и ту же пачку запросов
+                        if(is_decrease_ && now - last_decrease_ < std::chrono::seconds(1))
+                                return;
+                        is_decrease_ = true;
+                        last_decrease_ = now;
+                        set_rate(std::max(min_rate_, rate_per_minute_ * 0.5));
+                        tokens_ = std::min(tokens_, 0.0);
+                }
+
+                /** \brief Увеличить лимит после успешного запроса
+                 * \param now Текущее время
+                 */
+                void increase(const std::chrono::steady_clock::time_point now)
+                {
+                        if(rate_per_minute_ >= max_rate_)
+                                return;
+                        if(is_decrease_ && now - last_decrease_ < std::chrono::seconds(BINARY_API_RATE_LIMIT_HOLD_SECONDS))
+                                return;
+                        set_rate(std::min(max_rate_, rate_per_minute_ + 1.0));
+                }
+
+                /** \brief Получить текущий лимит
+                 * \return количество запросов в минуту
+                 */
+                inline double get_rate() const
+                {
+                        return rate_per_minute_;
+                }
+        };
+
+        /** \brief Оценка времени сервера по локальным часам
+         * Как в NTP, каждое наблюдение ограничивает смещение часов сервера относительно
+         * локальных часов. Ответ time со временем T на запрос, отправленный в момент t0
+         * и полученный в момент t1, дает T - t1 < смещение < T + 1 - t0. Тик со временем E,
+         * полученный в момент t1, дает смещение > E - t1. Границы пересекаются, а со временем
+         * расходятся на величину возможного ухода часов. Уход часов оценивается
+         * по наклону середин границ ответов time
+         */
+        class ServerClock {
+        private:
+                double lower_ = 0;      // нижняя граница смещения (секунды)
+                double upper_ = 0;      // верхняя граница смещения
+                double time_ = 0;       // локальное время, к которому относятся границы
+                double drift_ = 0;      // оценка ухода часов (секунд в секунду)
+                bool is_lower_ = false;
+                bool is_upper_ = false;
+                std::deque<std::pair<double, double>> samples_; // локальное время и середина границ по ответам time
+                size_t num_responses_ = 0;
+
+                void get_bounds(const double time, double &lower, double &upper) const
+                {
+                        const double dt = std::max(0.0, time - time_);
+                        lower = lower_ + (drift_ - BINARY_API_SERVER_CLOCK_WANDER) * dt;
+                        upper = upper_ + (drift_ + BINARY_API_SERVER_CLOCK_WANDER) * dt;
+                }
+
+                void add_bounds(const double time, const double lower, const double upper, const bool is_upper)
+                {
+                        double current_lower = 0, current_upper = 0;
+                        get_bounds(time, current_lower, current_upper);
+                        // наблюдение противоречит границам (например, часы сервера переведены) - начинаем заново
+                        if((is_upper_ && lower > current_upper) || (is_upper && is_lower_ && upper < current_lower)) {
+                                is_lower_ = is_upper_ = false;
+                                drift_ = 0;
+                                samples_.clear();
+                        }
+                        lower_ = is_lower_ ? std::max(current_lower, lower) : lower;
+                        if(is_upper) upper_ = is_upper_ ? std::min(current_upper, upper) : upper;
+                        else upper_ = current_upper;
+                        is_lower_ = true;
+                        is_upper_ = is_upper_ || is_upper;
+                        time_ = std::max(time_, time);
+                }
+
+                void update_drift()
+                {
+                        // погрешность одного ответа около секунды, поэтому нужен час наблюдений
+                        if(samples_.size() < 3 || samples_.back().first - samples_.front().first < 1800.0)
+                                return;
+                        double mean_x = 0, mean_y = 0;
+                        for(auto &sample : samples_) {
+                                mean_x += sample.first;
+                                mean_y += sample.second;
+                        }
+                        mean_x /= (double)samples_.size();
+                        mean_y /= (double)samples_.size();
+                        double sum_xy = 0, sum_xx = 0;
+                        for(auto &sample : samples_) {
+                                sum_xy += (sample.first - mean_x) * (sample.second - mean_y);
+                                sum_xx += (sample.first - mean_x) * (sample.first - mean_x);
+                        }
+                        if(sum_xx <= 0) return;
+                        drift_ = std::max(-BINARY_API_SERVER_CLOCK_MAX_DRIFT,
+                                          std::min(BINARY_API_SERVER_CLOCK_MAX_DRIFT, sum_xy / sum_xx));
+                }
+        public:
+                /** \brief Учесть ответ time
+                 * \param send_time Локальное время отправки запроса (секунды)
+                 * \param receive_time Локальное время получения ответа
+                 * \param server_time Время сервера из ответа
+                 */
+                void add_response(const double send_time, const double receive_time, const double server_time)
+                {
+                        add_bounds(receive_time, server_time - receive_time, server_time + 1.0 - send_time, true);
+                        const double middle_time = 0.5 * (send_time + receive_time);
+                        samples_.emplace_back(middle_time, server_time + 0.5 - middle_time);
+                        if(samples_.size() > BINARY_API_SERVER_CLOCK_SAMPLES) samples_.pop_front();
+                        ++num_responses_;
+                        update_drift();
+                }
+
+                /** \brief Учесть время сервера, которое уже наступило к моменту получения сообщения
+                 * \param receive_time Локальное время получения сообщения (секунды)
+                 * \param server_time Время сервера из сообщения (время тика и т.п.)
+                 */
+                void add_epoch(const double receive_time, const double server_time)
+                {
+                        add_bounds(receive_time, server_time - receive_time, 0, false);
+                }
+
+                /** \brief Оценить время сервера
+                 * \param time Локальное время (секунды)
+                 * \param server_time Время сервера
+                 * \param error Погрешность оценки
+                 * \return вернет false, если ответов time еще не было
+                 */
+                bool get(const double time, double &server_time, double &error) const
+                {
+                        if(!is_upper_) return false;
+                        double lower = 0, upper = 0;
+                        get_bounds(time, lower, upper);
+                        server_time = time + 0.5 * (lower + upper);
+                        error = 0.5 * (upper - lower);
+                        return true;
+                }
+
+                /// Количество учтенных ответов time
+                inline size_t get_num_responses() const {return num_responses_;}
+
+                /// Оценка ухода часов (секунд в секунду)
+                inline double get_drift() const {return drift_;}
+        };
+
+        /** \brief Общий лимит запросов всех объектов BinaryAPI процесса
+         * Сервер ограничивает запросы с одного IP и app_id, поэтому объекты одного процесса
+         * делят один лимит. Если токенов не хватает всем ждущим объектам, токен получает
+         * объект с сообщением наивысшего приоритета, при равных приоритетах - ждущий дольше всех
+         */
+        class ProcessBudget {
+        private:
+                class Client {
+                public:
+                        BudgetUsage usage;
+                        bool is_waiting = false;                                // объект ждет токен
+                        int priority = 0;                                       // приоритет ожидаемого токена
+                        std::chrono::steady_clock::time_point wait_since;       // начало ожидания
+                        std::chrono::steady_clock::time_point last_request;     // последний запрос токена
+                };
+                std::mutex mutex_;
+                AdaptiveLimiter limiter_;
+                std::map<int, Client> clients_;
+                int last_id_ = 0;
+
+                void consume(Client &client, const int priority)
+                {
+                        limiter_.take();
+                        client.usage.consumed[priority]++;
+                        client.is_waiting = false;
+                }
+        public:
+                ProcessBudget() :
+                        limiter_(BINARY_API_PROCESS_REQUESTS_PER_MINUTE,
+                                 std::min(BINARY_API_MIN_REQUESTS_PER_MINUTE, BINARY_API_PROCESS_REQUESTS_PER_MINUTE),
+                                 BINARY_API_PROCESS_REQUESTS_PER_MINUTE) {};
+
+                /** \brief Зарегистрировать объект
+                 * \return номер объекта
+                 */
+                int add_client()
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        const int id = ++last_id_;
+                        Client &client = clients_[id];
+                        client.usage.name = "BinaryAPI " + std::to_string(id);
+                        client.usage.consumed.fill(0);
+                        return id;
+                }
+
+                void remove_client(const int id)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        clients_.erase(id);
+                }
+
+                void set_name(const int id, const std::string &name)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        auto it = clients_.find(id);
+                        if(it != clients_.end()) it->second.usage.name = name;
+                }
+
+                /** \brief Получить токен для сообщения
+                 * \param id Номер объекта
+                 * \param priority Приоритет сообщения (см. SendPriority)
+                 * \param now Текущее время
+                 * \param wait Время до следующей попытки, если токен не получен
+                 * \return вернет true, если токен получен
+                 */
+                bool acquire(const int id, const int priority,
+                             const std::chrono::steady_clock::time_point now,
+                             std::chrono::steady_clock::duration &wait)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        Client &client = clients_[id];
+                        if(!client.is_waiting || client.priority != priority) {
+                                client.is_waiting = true;
+                                client.priority = priority;
+                                client.wait_since = now;
+                        }
+                        client.last_request = now;
+                        if(!limiter_.check(now, wait))
+                                return false;
+                        // объекты, которые ждут дольше или с более важным сообщением, получают токен первыми.
+                        // Объект, который перестал запрашивать токены, не учитывается
+                        const std::chrono::duration<double> token_period(60.0 / limiter_.get_rate());
+                        const std::chrono::duration<double> stale_period =
+                                std::max(std::chrono::duration<double>(0.5), token_period * 2);
+                        double ahead = 0;
+                        for(auto &item : clients_) {
+                                const Client &other = item.second;
+                                if(item.first == id || !other.is_waiting || now - other.last_request > stale_period)
+                                        continue;
+                                if(other.priority < priority ||
+                                   (other.priority == priority && other.wait_since < client.wait_since))
+                                        ahead += 1.0;
+                        }
+                        if(limiter_.get_tokens() >= ahead + 1.0) {
+                                consume(client, priority);
+                                return true;
+                        }
+                        client.usage.deferred++;
+                        wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(token_period);
+                        return false;
+                }
+
+                /** \brief Забрать токен без ожидания (для сделок, которые отправляются в обход очереди)
+                 * \param id Номер объекта
+                 * \param priority Приоритет сообщения (см. SendPriority)
+                 * \param now Текущее время
+                 */
+                void take(const int id, const int priority, const std::chrono::steady_clock::time_point now)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        std::chrono::steady_clock::duration wait;
+                        limiter_.check(now, wait);
+                        limiter_.take();
+                        auto it = clients_.find(id);
+                        if(it != clients_.end()) it->second.usage.consumed[priority]++;
+                }
+
+                /** \brief Подстроить лимит по ответу сервера
+                 * \param is_rate_limit Сервер вернул ошибку RateLimit
+                 * \param now Текущее время
+                 * \param count Количество успешных ответов (для увеличения лимита)
+                 */
+                void adapt(const bool is_rate_limit, const std::chrono::steady_clock::time_point now, const unsigned int count)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if(is_rate_limit) limiter_.decrease(now);
+                        else for(unsigned int i = 0; i < count; ++i) limiter_.increase(now);
+                }
+
+                void set_rate(const int requests_per_minute)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        limiter_ = AdaptiveLimiter(requests_per_minute,
+                                std::min(BINARY_API_MIN_REQUESTS_PER_MINUTE, requests_per_minute),
+                                requests_per_minute);
+                }
+
+                double get_rate()
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        return limiter_.get_rate();
+                }
+
+                void get_usage(std::vector<BudgetUsage> &usage)
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        usage.clear();
+                        usage.reserve(clients_.size());
+                        for(auto &item : clients_) {
+                                usage.push_back(item.second.usage);
+                        }
+                }
+        };
+
+        /// Общий лимит запросов процесса
+        static ProcessBudget &get_process_budget()
+        {
+                static ProcessBudget budget;
+                return budget;
+        }
+        int budget_id_; // номер объекта в общем лимите запросов процесса
+
+        /// Сообщение в очереди отправки
+        class QueuedMessage {
+        public:
+                std::string message;
+                long long req_id;                               // 0, если задержка ответа не измеряется
+                std::chrono::steady_clock::time_point time;     // время постановки в очередь
+        };
+        std::queue<QueuedMessage> send_queues_[SEND_PRIORITIES_NUM]; // Очереди сообщений по приоритетам (см. SendPriority)
+
+        /// Сообщение, отправка которого отложена
+        class DelayedMessage {
+        public:
+                std::chrono::steady_clock::time_point time;     // время отправки
+                std::string message;
+                int priority;                                   // приоритет отправки (см. SendPriority)
+                bool operator > (const DelayedMessage &other) const {return time > other.time;}
+        };
+        // отложенные сообщения, первым идет сообщение с наименьшим временем отправки
+        std::priority_queue<DelayedMessage, std::vector<DelayedMessage>, std::greater<DelayedMessage>> delayed_queue_;
+        std::unordered_set<std::string> delayed_messages_; // тексты отложенных сообщений, чтобы не дублировать повторы
+        std::deque<std::string> proposal_rollout_; // подписки на проценты выплат, ждущие лимита подписок
+        std::mutex send_queue_mutex_; // защищает send_queues_, delayed_queue_, delayed_messages_ и ограничители запросов
+        std::condition_variable send_queue_cond_; // будит поток отправки сообщений
+        AdaptiveLimiter send_limiter_; // ограничение числа запросов в минуту, общее для всех запросов
+        AdaptiveLimiter proposal_limiter_; // ограничение числа подписок на проценты выплат в минуту
+        std::vector<TokenBucket> send_budgets_; // доли ограничения запросов для каждого приоритета
+        std::thread send_thread_;
+        std::atomic<bool> is_shutdown_;
+        std::chrono::steady_clock::time_point last_send_; // время последней отправки сообщения
+        bool is_send_notified_ = false; // появились новые сообщения или изменилось состояние соединения
+        bool is_limiter_stall_ = false; // очередь ждет токен ограничителя запросов
+        std::chrono::steady_clock::time_point limiter_stall_time_; // начало ожидания токена
+
+        // статистика задержек запросов (см. get_latency_stats)
+        LatencyStats latency_stats_;
+        std::unordered_map<long long, std::chrono::steady_clock::time_point> request_send_times_; // время отправки запросов (ключ - req_id)
+        std::atomic<size_t> request_send_times_size_;
+        std::string latency_file_name_;
+        unsigned long long min_round_trip_ = 0; // наименьшая задержка ответа сервера (мкс)
+        unsigned int rate_increases_ = 0; // успешные ответы, еще не учтенные в лимите запросов
+        std::chrono::steady_clock::time_point rate_increase_time_; // время последнего увеличения лимита
+        std::mutex latency_mutex_; // защищает latency_stats_, request_send_times_, latency_file_name_, min_round_trip_ и rate_increases_
+        std::atomic<int> latency_dump_period_;
+        std::chrono::steady_clock::time_point latency_dump_time_; // используется только потоком соединения
+
+        // работа в общем цикле событий (см. BinaryApiEventLoop)
+        std::shared_ptr<BinaryApiEventLoop::IoService> io_service_; // не задан, если объект использует свои потоки
+        std::unique_ptr<binary_api_asio::steady_timer> send_timer_;
+        std::unique_ptr<binary_api_asio::steady_timer> restart_timer_;
+        std::atomic<bool> is_send_posted_;
+        std::atomic<bool> is_restart_;
+        std::shared_ptr<char> alive_;           // пока существует, обработчики цикла событий могут обращаться к объекту
+        std::weak_ptr<char> alive_weak_;
+
+        // параметры счета
+        std::atomic<double> balance_; // Баланс счета
+        std::string currency_ = ""; // Валюта счета
+        std::atomic<bool> is_authorize_;
+        std::mutex authorize_mutex_;
+
+        /// Ожидание готовности объекта (см. wait_ready_async)
+        class ReadyWaiter {
+        public:
+                std::shared_ptr<std::promise<int>> promise;
+                std::function<void(const int)> callback;
+                std::chrono::steady_clock::time_point deadline; // time_point::max(), если время ожидания не ограничено
+        };
+        std::vector<ReadyWaiter> ready_waiters_;
+        std::atomic<size_t> ready_waiters_size_;
+        std::mutex ready_mutex_; // защищает ready_waiters_
+        std::condition_variable ready_cond_;
+
+
+        // поток выплат и котировок
+        std::vector<std::string> symbols_;
+        std::unordered_map<std::string, int> map_symbol_;
+        std::shared_timed_mutex map_symbol_mutex_; // защищает map_symbol_, quotes_ и агрегатор тиков от изменения в init_symbols
+
+        std::vector<double> proposal_buy_;
+        std::vector<double> proposal_sell_;
+        /// Последнее предложение потока процентов выплат, по которому можно открыть сделку
+        class ProposalId {
+        public:
+                std::string id;         // proposal.id
+                double ask_price = 0;   // цена контракта
+                bool is_live = false;   // поток по этой валютной паре и направлению работает
+        };
+        std::vector<ProposalId> proposal_buy_ids_;
+        std::vector<ProposalId> proposal_sell_ids_;
+        std::mutex proposal_mutex_;
+        // история процентов выплат: BUY валютной пары indx лежит в payouts_[2 * indx], SELL - в payouts_[2 * indx + 1]
+        std::vector<std::unique_ptr<RingBuffer<PayoutPoint>>> payouts_;
+        std::atomic<size_t> payouts_capacity_;
+
+        std::vector<std::unique_ptr<RingBuffer<QuotationBar>>> quotes_; // бары потока котировок
+        std::atomic<size_t> quotes_capacity_;
+        // агрегатор тиков: бары валютной пары indx периода n лежат в aggregated_[indx * periods + n]
+        std::vector<unsigned long long> aggregator_periods_;
+        std::vector<std::unique_ptr<RingBuffer<CandleBar>>> aggregated_;
+        size_t aggregator_capacity_ = BINARY_API_AGGREGATOR_CAPACITY;
+
+        std::atomic<bool> is_stream_quotations_;
+        std::atomic<bool> is_stream_quotations_error_;
+        std::atomic<bool> is_stream_proposal_;
+        // подписки, которые восстанавливаются после переподключения (см. set_resume_mode)
+        std::atomic<bool> is_resume_mode_;
+        bool is_resume_quotations_ = false;
+        int resume_init_size_ = 0;
+        std::vector<std::string> resume_proposals_;
+        std::mutex resume_mutex_;
+        // время сервера
+        std::atomic<unsigned long long> last_time_;
+        std::atomic<bool> is_last_time_;
+        // оценка времени сервера (см. now_server)
+        ServerClock server_clock_;
+        std::chrono::steady_clock::time_point last_clock_sync_; // время последнего запроса time для оценки
+        bool is_clock_sync_ = false;
+        std::mutex server_clock_mutex_; // защищает server_clock_, last_clock_sync_ и is_clock_sync_
+        std::chrono::steady_clock::time_point time_request_send_; // время отправки запроса time, на который пришел ответ
+        bool is_time_request_send_ = false;
+        unsigned long long last_clock_epoch_ = 0; // последнее время сервера из потоков (используются только потоком соединения)
+        // запросы, ожидающие ответа (ключ - req_id)
+        std::unordered_map<long long, std::function<void(json &)>> pending_requests_;
+        std::mutex pending_requests_mutex_;
+        std::atomic<long long> last_req_id_;
+        // ответ на последний запрос баров для истории (download_candles + get_candles)
+        std::mutex array_candles_mutex_;
+        std::future<json> array_candles_;
+        long long array_candles_req_id_ = 0;
+        // ответ на последний запрос тиков для истории (download_ticks + get_ticks)
+        std::mutex array_ticks_mutex_;
+        std::future<json> array_ticks_;
+        long long array_ticks_req_id_ = 0;
+
+        /** \brief Фоновая запись логов (одна на процесс)
+         * Строки лога помещаются в ограниченную очередь без блокировок (много писателей, один читатель).
+         * Поток записи забирает строки пачками, держит файлы открытыми и переименовывает
+         * файл, если его размер превысил BINARY_API_LOG_MAX_FILE_SIZE.
+         * Если очередь заполнена, строка отбрасывается и учитывается в счетчике
+         */
+        class AsyncLogger {
+        private:
+                class LogMessage {
+                public:
+                        std::string file_name;
+                        std::string message;
+                };
+
+                class Cell {
+                public:
+                        std::atomic<size_t> sequence;
+                        LogMessage data;
+                };
+
+                class LogFile {
+                public:
+                        std::ofstream file;
+                        size_t size = 0;
+                };
+
+                static const size_t QUEUE_SIZE = BINARY_API_LOG_QUEUE_SIZE;
+                static_assert((QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0, "BINARY_API_LOG_QUEUE_SIZE must be a power of two");
+
+                std::unique_ptr<Cell[]> cells_;
+                std::atomic<size_t> enqueue_pos_;
+                size_t dequeue_pos_ = 0;                // используется только потоком записи
+                std::atomic<unsigned long long> dropped_;
+                std::atomic<bool> is_notified_;
+                std::atomic<bool> is_shutdown_;
+                std::mutex mutex_;
+                std::condition_variable cond_;
+                std::unordered_map<std::string, LogFile> files_;        // используется только потоком записи
+                std::thread thread_;
+
+                bool pop(LogMessage &msg)
+                {
+                        Cell &cell = cells_[dequeue_pos_ & (QUEUE_SIZE - 1)];
+                        if(cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+                                return false;
+                        msg = std::move(cell.data);
+                        cell.sequence.store(dequeue_pos_ + QUEUE_SIZE, std::memory_order_release);
+                        ++dequeue_pos_;
+                        return true;
+                }
+
+                void rotate(const std::string &file_name, LogFile &log_file)
+                {
+                        log_file.file.close();
+                        for(int i = BINARY_API_LOG_MAX_FILES; i > 0; --i) {
+                                const std::string new_name = file_name + "." + std::to_string(i);
+                                const std::string old_name = i > 1 ? file_name + "." + std::to_string(i - 1) : file_name;
+                                std::remove(new_name.c_str());
+                                std::rename(old_name.c_str(), new_name.c_str());
+                        }
+                        log_file.file.open(file_name, std::ios::app);
+                        log_file.size = 0;
+                }
+
+                void write(const std::string &file_name, const std::string &message)
+                {
+                        LogFile &log_file = files_[file_name];
+                        if(!log_file.file.is_open()) {
+                                log_file.file.open(file_name, std::ios::app);
+                                if(!log_file.file) return;
+                                log_file.file.seekp(0, std::ios::end);
+                                const std::streamoff size = log_file.file.tellp();
+                                log_file.size = size > 0 ? (size_t)size : 0;
+                        }
+                        log_file.file << message << "\n";
+                        log_file.size += message.size() + 1;
+                        if(log_file.size >= BINARY_API_LOG_MAX_FILE_SIZE)
+                                rotate(file_name, log_file);
+                }
+
+                void thread_loop()
+                {
+                        unsigned long long reported_dropped = 0;
+                        LogMessage msg;
+                        while(true) {
+                                const bool is_shutdown = is_shutdown_;
+                                is_notified_ = false;
+                                while(pop(msg)) {
+                                        try {
+                                                write(msg.file_name, msg.message);
+                                        }
+                                        catch(...) {}
+                                }
+                                const unsigned long long dropped = dropped_;
+                                if(dropped != reported_dropped && !msg.file_name.empty()) {
+                                        try {
+                                                write(msg.file_name, "BinaryApi: log queue overflow, dropped " +
+                                                        std::to_string(dropped - reported_dropped) + " messages");
+                                        }
+                                        catch(...) {}
+                                        reported_dropped = dropped;
+                                }
+                                for(auto &it : files_) it.second.file.flush();
+                                if(is_shutdown) break;
+                                std::unique_lock<std::mutex> lock(mutex_);
+                                cond_.wait_for(lock, std::chrono::seconds(1), [&]{
+                                        return is_shutdown_ || is_notified_;
+                                });
+                        }
+                }
+        public:
+                AsyncLogger() :
+                        cells_(new Cell[QUEUE_SIZE]),
+                        enqueue_pos_(0), dropped_(0),
+                        is_notified_(false), is_shutdown_(false) {
+                        for(size_t i = 0; i < QUEUE_SIZE; ++i) {
+                                cells_[i].sequence.store(i, std::memory_order_relaxed);
+                        }
+                        thread_ = std::thread([&]{thread_loop();});
+                };
+
+                ~AsyncLogger()
+                {
+                        {
+                                std::lock_guard<std::mutex> lock(mutex_);
+                                is_shutdown_ = true;
+                        }
+                        cond_.notify_one();
+                        if(thread_.joinable()) thread_.join();
+                }
+
+                /** \brief Добавить строку в очередь записи
+                 * \param file_name Имя файла
+                 * \param message Строка лога
+                 * \return вернет false, если очередь заполнена и строка отброшена
+                 */
+                bool push(const std::string &file_name, std::string message)
+                {
+                        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+                        Cell *cell = NULL;
+                        while(true) {
+                                cell = &cells_[pos & (QUEUE_SIZE - 1)];
+                                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                                const long long diff = (long long)sequence - (long long)pos;
+                                if(diff == 0) {
+                                        if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                                                break;
+                                } else
+                                if(diff < 0) {
+                                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                                        return false;
+                                } else {
+                                        pos = enqueue_pos_.load(std::memory_order_relaxed);
+                                }
+                        }
+                        cell->data.file_name = file_name;
+                        cell->data.message = std::move(message);
+                        cell->sequence.store(pos + 1, std::memory_order_release);
+                        // будим поток записи один раз на пачку строк
+                        if(!is_notified_.exchange(true)) cond_.notify_one();
+                        return true;
+                }
+
+                /// Количество отброшенных строк
+                inline unsigned long long get_dropped() const {return dropped_;}
+        };
+
+        /// Экземпляр фоновой записи логов, общий для всех объектов BinaryAPI
+        static AsyncLogger &get_logger()
+        {
+                static AsyncLogger logger;
+                return logger;
+        }
+
+        std::atomic<bool> is_use_log;
+//------------------------------------------------------------------------------
+        std::string format(const char *fmt, ...)
+        {
+                va_list args;
+                va_start(args, fmt);
+                std::vector<char> v(1024);
+                while (true)
+                {
+                        va_list args2;
+                        va_copy(args2, args);
+                        int res = vsnprintf(v.data(), v.size(), fmt, args2);
+                        if ((res >= 0) && (res < static_cast<int>(v.size())))
+                        {
+                            va_end(args);
+                            va_end(args2);
+                            return std::string(v.data());
+                        }
+                        size_t size;
+                        if (res < 0)
+                            size = v.size() * 2;
+                        else
+                            size = static_cast<size_t>(res) + 1;
+                        v.clear();
+                        v.resize(size);
+                        va_end(args2);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Отправить сообщение с задержкой
+         * Сообщение попадает в очередь отложенных сообщений потока отправки.
+         * Если такое же сообщение уже ожидает отправки, повтор не добавляется
+         * \param message Сообщение
+         * \param delay Задержка (мс)
+         * \param priority Приоритет отправки (см. SendPriority)
+         */
+        inline void send_message_delay(const std::string &message, const int delay, const int priority = SEND_SUBSCRIPTION)
+        {
+                const std::chrono::steady_clock::time_point time =
+                        std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+                send_queue_mutex_.lock();
+                if(!delayed_messages_.insert(message).second) {
+                        send_queue_mutex_.unlock();
+                        return;
+                }
+                delayed_queue_.push(DelayedMessage{time, message, priority});
+                is_send_notified_ = true;
+                send_queue_mutex_.unlock();
+                wake_send_queue();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Отправить сообщение
+         * \param message Сообщение
+         * \param req_id req_id запроса, если нужно измерить задержку ответа, иначе 0
+         * \param priority Приоритет отправки (см. SendPriority)
+         */
+        inline void send_message(const std::string &message, const long long req_id = 0, const int priority = SEND_SUBSCRIPTION)
+        {
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                send_queue_mutex_.lock();
+                send_queues_[priority].push(QueuedMessage{message, req_id, now});
+                is_send_notified_ = true;
+                send_queue_mutex_.unlock();
+                wake_send_queue();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Разбудить поток отправки сообщений
+         * Нужно вызывать после изменения состояния соединения, чтобы не потерять пробуждение
+         */
+        inline void notify_send_thread()
+        {
+                send_queue_mutex_.lock();
+                is_send_notified_ = true;
+                last_send_ = std::chrono::steady_clock::now();
+                send_queue_mutex_.unlock();
+                wake_send_queue();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Выполнить функцию в общем цикле событий
+         * Функция не будет вызвана, если объект уже удаляется
+         */
+        template <class FUNC_TYPE>
+        void post_to_event_loop(FUNC_TYPE func)
+        {
+                std::weak_ptr<char> alive = alive_weak_;
+                io_service_->post([alive, func]() {
+                        std::shared_ptr<char> lock = alive.lock();
+                        if(lock) func();
+                });
+        }
+//------------------------------------------------------------------------------
+        /// Разбудить поток отправки сообщений (или запланировать отправку в общем цикле событий)
+        inline void wake_send_queue()
+        {
+                if(!io_service_) {
+                        send_queue_cond_.notify_one();
+                        return;
+                }
+                if(is_send_posted_.exchange(true))
+                        return;
+                post_to_event_loop([&]() {
+                        pump_send_queue();
+                });
+        }
+//------------------------------------------------------------------------------
+        /** \brief Определить приоритет отправки запроса
+         * \param j Запрос
+         * \return приоритет отправки (см. SendPriority)
+         */
+        static int get_send_priority(const json &j)
+        {
+                if(!j.is_object())
+                        return SEND_SUBSCRIPTION;
+                if(j.find("buy") != j.end() || j.find("sell") != j.end())
+                        return SEND_ORDER;
+                if(j.find("ping") != j.end())
+                        return SEND_PING;
+                auto it_subscribe = j.find("subscribe");
+                if(j.find("ticks_history") != j.end() && (it_subscribe == j.end() || *it_subscribe != 1))
+                        return SEND_HISTORY;
+                return SEND_SUBSCRIPTION;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Учесть в ограничителе запросов сделку, отправленную в обход очереди
+         * Сделки не ждут в очереди, но занимают место в общем лимите запросов
+         */
+        void take_order_token()
+        {
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                std::chrono::steady_clock::duration wait;
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                send_limiter_.check(now, wait);
+                send_limiter_.take();
+                send_budgets_[SEND_ORDER].check(now, wait);
+                send_budgets_[SEND_ORDER].take();
+                get_process_budget().take(budget_id_, SEND_ORDER, now);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Поставить подписки на проценты выплат в очередь постепенной подписки
+         * Поток отправки сообщений переносит их в очередь отправки по мере появления
+         * лимита подписок, уже ожидающие подписки не дублируются
+         * \param messages Запросы подписки
+         */
+        void schedule_proposals(const std::vector<std::string> &messages)
+        {
+                send_queue_mutex_.lock();
+                for(size_t i = 0; i < messages.size(); ++i) {
+                        if(std::find(proposal_rollout_.begin(), proposal_rollout_.end(), messages[i]) == proposal_rollout_.end())
+                                proposal_rollout_.push_back(messages[i]);
+                }
+                is_send_notified_ = true;
+                send_queue_mutex_.unlock();
+                wake_send_queue();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Присвоить запросу req_id, если его нет
+         * По req_id ответ сервера сопоставляется с запросом для измерения задержки
+         * \param j Запрос
+         * \return req_id запроса
+         */
+        long long set_req_id(json &j)
+        {
+                auto it_req_id = j.find("req_id");
+                if(it_req_id != j.end() && it_req_id->is_number_integer())
+                        return *it_req_id;
+                const long long req_id = ++last_req_id_;
+                j["req_id"] = req_id;
+                return req_id;
+        }
+//------------------------------------------------------------------------------
+        int send_json_with_authorize(json &j)
+        {
+                if(is_authorize_) {
+                        const long long req_id = set_req_id(j);
+                        std::string message = j.dump();
+                        send_message(message, req_id, get_send_priority(j));
+                        return OK;
+                }
+                return NO_AUTHORIZATION;
+        }
+//------------------------------------------------------------------------------
+        int send_json(json &j)
+        {
+                if(is_open_connection_) {
+                        const long long req_id = set_req_id(j);
+                        std::string message = j.dump();
+                        send_message(message, req_id, get_send_priority(j));
+                        return OK;
+                }
+                return NO_OPEN_CONNECTION;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Передать ответ обработчику запроса
+         * Обработчик ищется в таблице ожидающих запросов по полю req_id и удаляется из нее
+         * \param j Ответ сервера
+         * \return вернет true, если обработчик запроса был найден
+         */
+        bool complete_request(json &j)
+        {
+                auto it_req_id = j.find("req_id");
+                if(it_req_id == j.end() || !it_req_id->is_number_integer())
+                        return false;
+                const long long req_id = *it_req_id;
+                std::function<void(json &)> callback;
+                pending_requests_mutex_.lock();
+                auto it_request = pending_requests_.find(req_id);
+                if(it_request == pending_requests_.end()) {
+                        pending_requests_mutex_.unlock();
+                        return false;
+                }
+                callback = std::move(it_request->second);
+                pending_requests_.erase(it_request);
+                pending_requests_mutex_.unlock();
+                if(callback) callback(j);
+                return true;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Завершить все ожидающие запросы с ошибкой
+         * Вызывается при разрыве соединения, так как ответы на отправленные запросы уже не придут
+         * \param code Код ошибки, который получат обработчики запросов
+         */
+        void cancel_requests(const std::string &code)
+        {
+                std::unordered_map<long long, std::function<void(json &)>> requests;
+                pending_requests_mutex_.lock();
+                requests.swap(pending_requests_);
+                pending_requests_mutex_.unlock();
+                for(auto &request : requests) {
+                        json j;
+                        j["req_id"] = request.first;
+                        j["error"]["code"] = code;
+                        j["error"]["message"] = "The request was cancelled";
+                        if(request.second) request.second(j);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Забыть запрос, ответ на который больше не ждут
+         * Запрос может еще стоять в очереди отправки, поэтому обработчик удаляется
+         * независимо от того, был ли запрос отправлен
+         * \param req_id ID запроса
+         */
+        void forget_request(const long long req_id)
+        {
+                latency_mutex_.lock();
+                request_send_times_.erase(req_id);
+                request_send_times_size_ = request_send_times_.size();
+                latency_mutex_.unlock();
+                pending_requests_mutex_.lock();
+                pending_requests_.erase(req_id);
+                pending_requests_mutex_.unlock();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Дождаться ответа на запрос
+         * Если ответ не пришел, запрос забывается, чтобы не копить обработчики
+         * \param response Ответ на запрос
+         * \param j Полученное сообщение
+         * \param req_id ID запроса или 0, если он неизвестен (тогда запрос остается в таблице до разрыва соединения)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int wait_response(std::future<json> &response, json &j, const long long req_id = 0)
+        {
+                if(!response.valid())
+                        return NO_COMMAND;
+                const std::chrono::seconds MAX_DELAY(60);
+                // слишком долго ждем ответ
+                if(response.wait_for(MAX_DELAY) != std::future_status::ready) {
+                        if(req_id != 0) forget_request(req_id);
+                        return UNKNOWN_ERROR;
+                }
+                try {
+                        j = response.get();
+                }
+                catch(const std::future_error &) {
+                        // обработчик запроса удален без ответа (например, вместе с объектом)
+                        return UNKNOWN_ERROR;
+                }
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Сформировать запрос исторических данных
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int make_history_request(json &j,
+                                 std::string &symbol,
+                                 unsigned long long startepoch,
+                                 unsigned long long endepoch,
+                                 int count,
+                                 bool is_candles)
+        {
+                if(!is_candles) {
+                        if(startepoch > 0 && endepoch > startepoch) {
+                                unsigned long long diff = endepoch - startepoch;
+                                if((symbol.find("R_") == std::string::npos && diff > 5000)
+                                        || (symbol.find("R_") != std::string::npos && diff > 10000))
+                                        return INVALID_PARAMETER;
+                        }
+                        if(count > 5000)
+                                return INVALID_PARAMETER;
+                }
+                j["ticks_history"] = symbol;
+                if(endepoch == 0) j["end"] = "latest";
+                else j["end"] = endepoch;
+                if(startepoch == 0) {
+                        j["start"] = 1;
+                        j["count"] = count;
+                } else {
+                        j["start"] = startepoch;
+                }
+                if(is_candles) {
+                        j["style"] = "candles";
+                        j["granularity"] = 60;
+                } else {
+                        j["style"] = "ticks";
+                }
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Добавить часть исторических данных в конец массивов
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        template <class T1, class T2>
+        static int append_history(std::vector<T1> &dst1,
+                                  std::vector<T2> &dst2,
+                                  const std::vector<T1> &src1,
+                                  const std::vector<T2> &src2)
+        {
+                const auto dst1_size = dst1.size();
+                const auto dst2_size = dst2.size();
+                try {
+                        dst1.reserve(dst1_size + src1.size());
+                        dst2.reserve(dst2_size + src2.size());
+                        dst1.insert(dst1.end(), src1.begin(), src1.end());
+                        dst2.insert(dst2.end(), src2.begin(), src2.end());
+                }
+                catch(...) {
+                        dst1.erase(dst1.begin() + dst1_size, dst1.end());
+                        dst2.erase(dst2.begin() + dst2_size, dst2.end());
+                        return UNKNOWN_ERROR;
+                }
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Добавить часть исторических данных в конец массива
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        template <class T>
+        static int append_history(std::vector<T> &dst, const std::vector<T> &src)
+        {
+                const auto dst_size = dst.size();
+                try {
+                        dst.reserve(dst_size + src.size());
+                        dst.insert(dst.end(), src.begin(), src.end());
+                }
+                catch(...) {
+                        dst.erase(dst.begin() + dst_size, dst.end());
+                        return UNKNOWN_ERROR;
+                }
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Загрузить исторические данные частями
+         * Запросы частей отправляются заранее, одновременно выполняется не более
+         * max_requests запросов. Ответы обрабатываются строго по порядку частей
+         * \param startepoch Начальное время
+         * \param endepoch Конечное время
+         * \param chunk_size Длительность одной части
+         * \param offset_time Смещение начала следующей части, чтобы один и тот же момент времени не встречался дважды
+         * \param max_requests Максимальное число одновременно выполняемых запросов
+         * \param chunks_per_second Достигнутая скорость загрузки (частей в секунду)
+         * \param download Функция отправки запроса части (возвращает ответ и req_id запроса)
+         * \param append Функция добавления полученной части
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        template <class DOWNLOAD_FUNCTION, class APPEND_FUNCTION>
+        int get_history_pipelined(unsigned long long startepoch,
+                                  unsigned long long endepoch,
+                                  unsigned long long chunk_size,
+                                  unsigned long long offset_time,
+                                  int max_requests,
+                                  double &chunks_per_second,
+                                  DOWNLOAD_FUNCTION download,
+                                  APPEND_FUNCTION append)
+        {
+                chunks_per_second = 0.0;
+                if(startepoch == 0 || endepoch == 0 || endepoch < startepoch || max_requests < 1)
+                        return INVALID_PARAMETER;
+                struct Chunk {
+                        unsigned long long startepoch;
+                        unsigned long long endepoch;
+                        std::future<json> response;
+                        long long req_id = 0;
+                };
+                std::deque<Chunk> chunks;
+                unsigned long long epoch = startepoch;
+                bool is_last_chunk = false;
+                size_t num_chunks = 0;
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                while(true) {
+                        // держим в работе до max_requests запросов
+                        while(!is_last_chunk && (int)chunks.size() < max_requests) {
+                                Chunk chunk;
+                                chunk.startepoch = epoch;
+                                chunk.endepoch = std::min(epoch + chunk_size, endepoch);
+                                int err_data = download(chunk.startepoch, chunk.endepoch, chunk.response, chunk.req_id);
+                                if(err_data != OK)
+                                        return err_data;
+                                if(chunk.endepoch == endepoch) {
+                                        is_last_chunk = true;
+                                } else {
+                                        epoch = chunk.endepoch + offset_time;
+                                }
+                                chunks.push_back(std::move(chunk));
+                        }
+                        if(chunks.empty())
+                                break;
+                        json j;
+                        int err_data = wait_response(chunks.front().response, j, chunks.front().req_id);
+                        if(err_data != OK)
+                                return err_data;
+                        err_data = append(j, chunks.front().startepoch, chunks.front().endepoch);
+                        if(err_data != OK)
+                                return err_data;
+                        chunks.pop_front();
+                        ++num_chunks;
+                        const double diff = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                        if(diff > 0) chunks_per_second = (double)num_chunks / diff;
+                }
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Учесть отправку сообщения в статистике задержек
+         * \param queued Сообщение из очереди отправки
+         * \param now Время отправки
+         * \param stall Время ожидания токена ограничителя запросов перед отправкой (0, если не ждали)
+         */
+        void add_send_latency(const QueuedMessage &queued,
+                              const std::chrono::steady_clock::time_point now,
+                              const std::chrono::steady_clock::duration stall)
+        {
+                std::lock_guard<std::mutex> lock(latency_mutex_);
+                latency_stats_.queue_wait.add(get_latency_us(now - queued.time));
+                if(stall.count() > 0) latency_stats_.limiter_stall.add(get_latency_us(stall));
+                if(queued.req_id != 0) {
+                        request_send_times_[queued.req_id] = now;
+                        request_send_times_size_ = request_send_times_.size();
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Учесть ответ сервера в статистике задержек
+         * Вызывается из потока соединения после разбора сообщения
+         * \param str Сообщение
+         * \param is_error Сообщение содержит ошибку (определяется при разборе сообщения)
+         */
+        void add_response_latency(const std::string &str, const bool is_error)
+        {
+                long long req_id = 0;
+                if(!find_req_id(str, req_id))
+                        return;
+                std::unique_lock<std::mutex> lock(latency_mutex_);
+                auto it_request = request_send_times_.find(req_id);
+                if(it_request == request_send_times_.end())
+                        return;
+                const std::string &msg_type = msg_type_.empty() ? std::string("unknown") : msg_type_;
+                const unsigned long long round_trip = get_latency_us(receive_time_ - it_request->second);
+                latency_stats_.round_trip[msg_type].add(round_trip);
+                if(msg_type_ == "time") {
+                        // время отправки нужно для оценки времени сервера
+                        time_request_send_ = it_request->second;
+                        is_time_request_send_ = true;
+                }
+                request_send_times_.erase(it_request);
+                request_send_times_size_ = request_send_times_.size();
+                if(min_round_trip_ == 0 || round_trip < min_round_trip_) min_round_trip_ = round_trip;
+                // медленный ответ - признак перегрузки, лимит не увеличиваем
+                const bool is_slow = round_trip > 3 * min_round_trip_ &&
+                        round_trip > BINARY_API_SLOW_RESPONSE_MS * 1000ULL;
+                if(!is_slow && !is_error) ++rate_increases_;
+                // лимит увеличиваем сразу за все успешные ответы, не чаще раза в секунду
+                if(rate_increases_ == 0 || receive_time_ - rate_increase_time_ < std::chrono::seconds(1))
+                        return;
+                const unsigned int count = rate_increases_;
+                rate_increases_ = 0;
+                rate_increase_time_ = receive_time_;
+                lock.unlock();
+                adapt_send_rate(false, false, count);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Подстроить лимит запросов по ответу сервера
+         * \param is_rate_limit Сервер вернул ошибку RateLimit
+         * \param is_proposal Ответ на подписку на проценты выплат
+         * \param count Количество успешных ответов (для увеличения лимита)
+         */
+        void adapt_send_rate(const bool is_rate_limit, const bool is_proposal, const unsigned int count = 1)
+        {
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                // подписки на проценты выплат имеют отдельный лимит сервера
+                AdaptiveLimiter &limiter = is_proposal ? proposal_limiter_ : send_limiter_;
+                if(is_rate_limit) limiter.decrease(now);
+                else for(unsigned int i = 0; i < count; ++i) limiter.increase(now);
+                if(!is_proposal) get_process_budget().adapt(is_rate_limit, now, count);
+        }
+//------------------------------------------------------------------------------
+        static unsigned long long get_latency_us(const std::chrono::steady_clock::duration latency)
+        {
+                const long long us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+                return us > 0 ? (unsigned long long)us : 0;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Записать статистику задержек в файл, если подошло время
+         * Вызывается из потока соединения после обработки сообщения
+         */
+        void dump_latency_stats()
+        {
+                const int period = latency_dump_period_;
+                if(period <= 0 || receive_time_ < latency_dump_time_)
+                        return;
+                latency_dump_time_ = receive_time_ + std::chrono::seconds(period);
+                LatencyStats stats;
+                std::string file_name;
+                latency_mutex_.lock();
+                stats = latency_stats_;
+                file_name = latency_file_name_;
+                latency_mutex_.unlock();
+                if(file_name.empty())
+                        return;
+                auto format_line = [&](const std::string &name, const LatencyHistogram &histogram) {
+                        return format("%s: count %llu, min %llu, mean %.1f, p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+                                name.c_str(),
+                                histogram.get_count(),
+                                histogram.get_min(),
+                                histogram.get_mean(),
+                                histogram.get_percentile(50.0),
+                                histogram.get_percentile(90.0),
+                                histogram.get_percentile(99.0),
+                                histogram.get_percentile(99.9),
+                                histogram.get_max());
+                };
+                std::string message = "latency, us (" + xtime::get_str_date_time() + "):\n";
+                message += format_line("queue_wait", stats.queue_wait);
+                message += format_line("limiter_stall", stats.limiter_stall);
+                for(auto &it : stats.round_trip) {
+                        message += format_line(it.first, it.second);
+                }
+                get_logger().push(file_name, std::move(message));
+        }
+//------------------------------------------------------------------------------
+        /** \brief Отправить сообщения, которые можно отправить сейчас
+         * Учитывает ограничение числа запросов, отложенные сообщения, ping
+         * и постепенную подписку на проценты выплат
+         * \param lock Захваченный send_queue_mutex_ (освобождается на время отправки)
+         * \return время, когда нужно вызвать функцию снова (time_point::max(), если нужно ждать событий)
+         */
+        std::chrono::steady_clock::time_point send_pending_messages(std::unique_lock<std::mutex> &lock)
+        {
+                const std::chrono::seconds PING_DELAY(20);
+                while(!is_shutdown_) {
+                        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                        // переносим в очередь сообщения, время отправки которых наступило
+                        while(!delayed_queue_.empty() && delayed_queue_.top().time <= now) {
+                                delayed_messages_.erase(delayed_queue_.top().message);
+                                send_queues_[delayed_queue_.top().priority].push(QueuedMessage{delayed_queue_.top().message, 0, now});
+                                delayed_queue_.pop();
+                        }
+                        if(!is_open_connection_)
+                                return std::chrono::steady_clock::time_point::max();
+                        // подписки на проценты выплат переносим в очередь, пока есть лимит подписок
+                        std::chrono::steady_clock::duration wait;
+                        std::chrono::steady_clock::time_point rollout_next = std::chrono::steady_clock::time_point::max();
+                        while(!proposal_rollout_.empty()) {
+                                if(!proposal_limiter_.check(now, wait)) {
+                                        rollout_next = now + wait;
+                                        break;
+                                }
+                                proposal_limiter_.take();
+                                send_queues_[SEND_SUBSCRIPTION].push(QueuedMessage{std::move(proposal_rollout_.front()), 0, now});
+                                proposal_rollout_.pop_front();
+                        }
+                        if(get_send_queue_size_locked() == 0) {
+                                // если долго ничего не отправляли, отправим ping
+                                const std::chrono::steady_clock::time_point ping_time = last_send_ + PING_DELAY;
+                                if(now < ping_time) {
+                                        if(!delayed_queue_.empty() && delayed_queue_.top().time < ping_time)
+                                                return std::min(rollout_next, delayed_queue_.top().time);
+                                        return std::min(rollout_next, ping_time);
+                                }
+                                json j;
+                                j["ping"] = 1;
+                                const long long req_id = ++last_req_id_;
+                                j["req_id"] = req_id;
+                                send_queues_[SEND_PING].push(QueuedMessage{j.dump(), req_id, now});
+                        }
+                        // выберем очередь с наивысшим приоритетом, у которой осталась доля лимита запросов
+                        std::chrono::steady_clock::time_point next = rollout_next;
+                        if(!delayed_queue_.empty()) next = std::min(next, delayed_queue_.top().time);
+                        int priority = 0;
+                        for(; priority < SEND_PRIORITIES_NUM; ++priority) {
+                                if(send_queues_[priority].empty()) continue;
+                                if(send_budgets_[priority].check(now, wait)) break;
+                                next = std::min(next, now + wait);
+                        }
+                        if(priority == SEND_PRIORITIES_NUM)
+                                return next;
+                        // проверим ограничение запросов в минуту этого объекта и всего процесса
+                        if(!send_limiter_.check(now, wait) ||
+                           !get_process_budget().acquire(budget_id_, priority, now, wait)) {
+                                if(!is_limiter_stall_) {
+                                        is_limiter_stall_ = true;
+                                        limiter_stall_time_ = now;
+                                }
+                                return std::min(rollout_next, now + wait);
+                        }
+                        send_limiter_.take();
+                        send_budgets_[priority].take();
+                        const std::chrono::steady_clock::duration stall = is_limiter_stall_ ?
+                                now - limiter_stall_time_ : std::chrono::steady_clock::duration::zero();
+                        is_limiter_stall_ = false;
+                        QueuedMessage queued = std::move(send_queues_[priority].front());
+                        send_queues_[priority].pop();
+                        lock.unlock();
+                        add_send_latency(queued, now, stall);
+                        connection_mutex_.lock();
+                        if(save_connection_) save_connection_->send(queued.message);
+                        connection_mutex_.unlock();
+                        lock.lock();
+                        last_send_ = std::chrono::steady_clock::now();
+                }
+                return std::chrono::steady_clock::time_point::max();
+        }
+//------------------------------------------------------------------------------
+        /// Количество сообщений во всех очередях отправки (нужно вызывать под send_queue_mutex_)
+        size_t get_send_queue_size_locked() const
+        {
+                size_t size = 0;
+                for(int i = 0; i < SEND_PRIORITIES_NUM; ++i) {
+                        size += send_queues_[i].size();
+                }
+                return size;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Проверить готовность объекта
+         * Объект готов, когда соединение установлено, а если задан токен - пройдена авторизация
+         * \param state Состояние ошибки (0, если объект готов, иначе см. ErrorType)
+         * \return вернет true, если ждать больше нечего (объект готов или токен неверный)
+         */
+        bool check_ready(int &state)
+        {
+                token_mutex_.lock();
+                const bool is_token = token_ != "";
+                token_mutex_.unlock();
+                if(is_token && is_error_token_) {
+                        state = NO_AUTHORIZATION;
+                        return true;
+                }
+                if(is_token ? is_authorize_ : is_open_connection_) {
+                        state = OK;
+                        return true;
+                }
+                state = is_open_connection_ ? NO_AUTHORIZATION : NO_OPEN_CONNECTION;
+                return false;
+        }
+//------------------------------------------------------------------------------
+        static void complete_ready_waiter(ReadyWaiter &waiter, const int state)
+        {
+                if(waiter.promise) waiter.promise->set_value(state);
+                if(waiter.callback) waiter.callback(state);
+        }
+//------------------------------------------------------------------------------
+        /// Сообщить ожидающим, что соединение или авторизация изменились
+        void notify_ready()
+        {
+                std::vector<ReadyWaiter> completed;
+                int state = OK;
+                {
+                        std::lock_guard<std::mutex> lock(ready_mutex_);
+                        ready_cond_.notify_all();
+                        if(ready_waiters_.empty() || !check_ready(state))
+                                return;
+                        completed.swap(ready_waiters_);
+                        ready_waiters_size_ = 0;
+                }
+                for(size_t i = 0; i < completed.size(); ++i) {
+                        complete_ready_waiter(completed[i], state);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Завершить ожидания готовности, время которых истекло
+         * \param lock Захваченный send_queue_mutex_ (освобождается на время вызова обработчиков)
+         * \return время, когда истечет следующее ожидание (time_point::max(), если ожиданий нет)
+         */
+        std::chrono::steady_clock::time_point check_ready_timeouts(std::unique_lock<std::mutex> &lock)
+        {
+                if(ready_waiters_size_ == 0)
+                        return std::chrono::steady_clock::time_point::max();
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                std::chrono::steady_clock::time_point next = std::chrono::steady_clock::time_point::max();
+                std::vector<ReadyWaiter> expired;
+                int state = OK;
+                {
+                        std::lock_guard<std::mutex> ready_lock(ready_mutex_);
+                        check_ready(state);
+                        for(size_t i = 0; i < ready_waiters_.size();) {
+                                if(ready_waiters_[i].deadline <= now) {
+                                        expired.push_back(std::move(ready_waiters_[i]));
+                                        ready_waiters_[i] = std::move(ready_waiters_.back());
+                                        ready_waiters_.pop_back();
+                                } else {
+                                        next = std::min(next, ready_waiters_[i].deadline);
+                                        ++i;
+                                }
+                        }
+                        ready_waiters_size_ = ready_waiters_.size();
+                }
+                if(!expired.empty()) {
+                        lock.unlock();
+                        for(size_t i = 0; i < expired.size(); ++i) {
+                                complete_ready_waiter(expired[i], state);
+                        }
+                        lock.lock();
+                }
+                return next;
+        }
+//------------------------------------------------------------------------------
+        void add_ready_waiter(ReadyWaiter &&waiter, const long long timeout_ms)
+        {
+                waiter.deadline = timeout_ms > 0 ?
+                        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms) :
+                        std::chrono::steady_clock::time_point::max();
+                int state = OK;
+                {
+                        std::lock_guard<std::mutex> lock(ready_mutex_);
+                        if(!check_ready(state)) {
+                                ready_waiters_.push_back(std::move(waiter));
+                                ready_waiters_size_ = ready_waiters_.size();
+                                state = UNKNOWN_ERROR;
+                        }
+                }
+                if(state != UNKNOWN_ERROR) {
+                        complete_ready_waiter(waiter, state);
+                        return;
+                }
+                // время ожидания отсчитывает поток отправки сообщений
+                send_queue_mutex_.lock();
+                is_send_notified_ = true;
+                send_queue_mutex_.unlock();
+                wake_send_queue();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Поток отправки сообщений
+         * Поток спит, пока очередь пуста или соединение закрыто, и просыпается
+         * по сигналу send_queue_cond_. При исчерпании лимита запросов поток спит
+         * до появления следующего токена
+         */
+        void send_thread_loop()
+        {
+                std::unique_lock<std::mutex> lock(send_queue_mutex_);
+                while(!is_shutdown_) {
+                        is_send_notified_ = false;
+                        std::chrono::steady_clock::time_point next = send_pending_messages(lock);
+                        next = std::min(next, check_ready_timeouts(lock));
+                        auto is_wake = [&]{
+                                return is_shutdown_ || is_send_notified_;
+                        };
+                        if(next == std::chrono::steady_clock::time_point::max()) {
+                                send_queue_cond_.wait(lock, is_wake);
+                        } else {
+                                send_queue_cond_.wait_until(lock, next, is_wake);
+                        }
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Отправить сообщения в общем цикле событий
+         * Вместо ожидания в потоке отправки взводится таймер
+         */
+        void pump_send_queue()
+        {
+                is_send_posted_ = false;
+                std::unique_lock<std::mutex> lock(send_queue_mutex_);
+                if(is_shutdown_) return;
+                is_send_notified_ = false;
+                std::chrono::steady_clock::time_point next = send_pending_messages(lock);
+                if(is_shutdown_) return;
+                next = std::min(next, check_ready_timeouts(lock));
+                if(next == std::chrono::steady_clock::time_point::max()) {
+                        send_timer_->cancel();
+                        return;
+                }
+                send_timer_->expires_at(next);
+                std::weak_ptr<char> alive = alive_weak_;
+                send_timer_->async_wait([&, alive](const SimpleWeb::error_code &ec) {
+                        if(ec) return;
+                        std::shared_ptr<char> lock = alive.lock();
+                        if(lock) pump_send_queue();
+                });
+        }
+//------------------------------------------------------------------------------
+        /** \brief Составить запрос подписки на поток минутных свечей
+         * \param j Запрос
+         * \param symbol Символ
+         * \param count Количество свечей истории
+         * \param start Время начала истории. Если 0, будут загружены последние count свечей
+         */
+        void make_quotations_request(json &j, const std::string &symbol, const int count, const unsigned long long start)
+        {
+                j["ticks_history"] = symbol;
+                j["subscribe"] = 1;
+                j["end"] = "latest";
+                j["style"] = "candles";
+                j["granularity"] = 60;
+                j["adjust_start_time"] = 1;
+                if(start != 0) j["start"] = start;
+                j["count"] = count;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Восстановить подписки после переподключения
+         * Поток котировок подписывается заново запросом ticks_history, который начинается
+         * с последнего сохраненного бара, поэтому пропущенные за время обрыва бары догружаются
+         * одним запросом и дописываются в буфер. Подписки на проценты выплат отправляются повторно
+         */
+        void resume_streams()
+        {
+                if(!is_resume_mode_) return;
+                std::lock_guard<std::mutex> lock(resume_mutex_);
+                if(is_resume_quotations_) {
+                        std::shared_lock<std::shared_timed_mutex> symbol_lock(map_symbol_mutex_);
+                        for(size_t i = 0; i < symbols_.size() && i < quotes_.size(); ++i) {
+                                json j;
+#                               if BINARY_API_USE_TICKS_HISTORY_SUBSCRIBE == 0
+                                j["ticks"] = symbols_[i];
+                                j["subscribe"] = 1;
+#                               else
+                                QuotationBar last = QuotationBar();
+                                if(quotes_[i]->back(last)) {
+                                        make_quotations_request(j, symbols_[i], 5000, last.timestamp);
+                                } else {
+                                        make_quotations_request(j, symbols_[i], resume_init_size_, 0);
+                                }
+#                               endif
+                                const long long req_id = set_req_id(j);
+                                send_message(j.dump(), req_id, SEND_SUBSCRIPTION);
+                        }
+                        is_stream_quotations_ = true;
+                }
+                // подписки на проценты выплат восстанавливаются постепенно, в пределах лимита подписок
+                schedule_proposals(resume_proposals_);
+                if(resume_proposals_.size() > 0) is_stream_proposal_ = true;
+        }
+//------------------------------------------------------------------------------
+        /// Забыть предложения потока процентов выплат (они действуют, пока есть подписка)
+        void clear_proposal_ids()
+        {
+                std::lock_guard<std::mutex> lock(proposal_mutex_);
+                for(size_t i = 0; i < proposal_buy_ids_.size(); ++i) proposal_buy_ids_[i] = ProposalId();
+                for(size_t i = 0; i < proposal_sell_ids_.size(); ++i) proposal_sell_ids_[i] = ProposalId();
+        }
+//------------------------------------------------------------------------------
+        /// Сбросить состояние после разрыва соединения
+        void reset_connection_state()
+        {
+                is_stream_quotations_ = false;
+                is_stream_proposal_ = false;
+                is_open_connection_ = false;
+                is_authorize_ = false;
+                is_last_time_ = false;
+                // ответы на отправленные запросы уже не придут
+                cancel_requests("ConnectionClosed");
+                clear_proposal_ids();
+                latency_mutex_.lock();
+                request_send_times_.clear();
+                request_send_times_size_ = 0;
+                latency_mutex_.unlock();
+        }
+//------------------------------------------------------------------------------
+        /// Подключиться к серверу в общем цикле событий
+        void start_client()
+        {
+                std::cout << "BinaryApi: start" << std::endl;
+                is_restart_ = false;
+                try {
+                        client_.start();
+                }
+                catch(std::exception &e) {
+                        write_log_file("BinaryApi: Error, error message: " + std::string(e.what()));
+                        restart_client();
+                }
+                catch(...) {
+                        write_log_file("BinaryApi: Error, error");
+                        restart_client();
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Переподключиться к серверу в общем цикле событий
+         * Переподключение выполняется по таймеру, через 5 секунд после разрыва соединения
+         */
+        void restart_client()
+        {
+                if(is_shutdown_ || is_restart_.exchange(true))
+                        return;
+                std::cout << "BinaryApi: restart" << std::endl;
+                reset_connection_state();
+                restart_timer_->expires_from_now(std::chrono::seconds(5));
+                std::weak_ptr<char> alive = alive_weak_;
+                restart_timer_->async_wait([&, alive](const SimpleWeb::error_code &ec) {
+                        if(ec) return;
+                        std::shared_ptr<char> lock = alive.lock();
+                        if(lock && !is_shutdown_) start_client();
+                });
+        }
+//------------------------------------------------------------------------------
+        void write_log_file(std::string file_name, std::string message)
+        {
+                if(is_use_log) {
+                        get_logger().push(file_name, std::move(message));
+                }
+        }
+//------------------------------------------------------------------------------
+        void write_log_file(std::string message)
+        {
+                if(!is_use_log)
+                        return;
+                std::string str_line = "//------------------------------------------------------------------------------\n";
+                std::string error_message = str_line +
+                        "start of error message (" +
+                        xtime::get_str_date_time() + "):\n" +
+                        message + "\nend of error message\n" + str_line;
+                write_log_file(log_file_name, error_message);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Обработчик потокового (SAX) разбора сообщений
+         * Запоминает только поля, нужные для обработки сообщений tick, ohlc и proposal
+         */
+        class FastMessageParser {
+        private:
+                enum {
+                        KEY_OTHER = 0,
+                        KEY_MSG_TYPE,
+                        KEY_TICK,
+                        KEY_OHLC,
+                        KEY_PROPOSAL,
+                        KEY_ECHO_REQ,
+                        KEY_ERROR,
+                        KEY_SYMBOL,
+                        KEY_EPOCH,
+                        KEY_QUOTE,
+                        KEY_OPEN_TIME,
+                        KEY_CLOSE,
+                        KEY_OPEN,
+                        KEY_HIGH,
+                        KEY_LOW,
+                        KEY_ASK_PRICE,
+                        KEY_PAYOUT,
+                        KEY_CODE,
+                        KEY_CONTRACT_TYPE,
+                        KEY_SUBSCRIBE,
+                        KEY_ID,
+                        KEY_SPOT_TIME,
+                };
+                FastMessage &msg_;
+                int depth_ = 0;                 // глубина вложенности объектов и массивов
+                int top_key_ = KEY_OTHER;       // последний ключ верхнего уровня
+                int object_ = KEY_OTHER;        // объект верхнего уровня, внутри которого находимся
+                int key_ = KEY_OTHER;           // последний ключ внутри объекта верхнего уровня
+
+                static int get_key(const std::string &key)
+                {
+                        // ключей немного, поэтому сравниваем по длине и содержимому без хеширования
+                        switch(key.size()) {
+                        case 2:
+                                if(key == "id") return KEY_ID;
+                                break;
+                        case 3:
+                                if(key == "low") return KEY_LOW;
+                                break;
+                        case 4:
+                                if(key == "tick") return KEY_TICK;
+                                if(key == "ohlc") return KEY_OHLC;
+                                if(key == "code") return KEY_CODE;
+                                if(key == "open") return KEY_OPEN;
+                                if(key == "high") return KEY_HIGH;
+                                break;
+                        case 5:
+                                if(key == "epoch") return KEY_EPOCH;
+                                if(key == "quote") return KEY_QUOTE;
+                                if(key == "close") return KEY_CLOSE;
+                                if(key == "error") return KEY_ERROR;
+                                break;
+                        case 6:
+                                if(key == "symbol") return KEY_SYMBOL;
+                                if(key == "payout") return KEY_PAYOUT;
+                                break;
+                        case 8:
+                                if(key == "msg_type") return KEY_MSG_TYPE;
+                                if(key == "proposal") return KEY_PROPOSAL;
+                                if(key == "echo_req") return KEY_ECHO_REQ;
+                                break;
+                        case 9:
+                                if(key == "open_time") return KEY_OPEN_TIME;
+                                if(key == "ask_price") return KEY_ASK_PRICE;
+                                if(key == "subscribe") return KEY_SUBSCRIBE;
+                                if(key == "spot_time") return KEY_SPOT_TIME;
+                                break;
+                        case 13:
+                                if(key == "contract_type") return KEY_CONTRACT_TYPE;
+                                break;
+                        default:
+                                break;
+                        }
+                        return KEY_OTHER;
+                }
+
+                inline bool is_data_object() const
+                {
+                        return object_ == KEY_TICK || object_ == KEY_OHLC || object_ == KEY_PROPOSAL;
+                }
+
+                void set_integer(const unsigned long long value)
+                {
+                        if(depth_ != 2) return;
+                        if(object_ == KEY_ECHO_REQ) {
+                                if(key_ == KEY_SUBSCRIBE) msg_.subscribe = (int)value;
+                                return;
+                        }
+                        if(!is_data_object()) return;
+                        switch(key_) {
+                        case KEY_EPOCH: msg_.epoch = value; break;
+                        case KEY_SPOT_TIME: msg_.epoch = value; break;
+                        case KEY_OPEN_TIME: msg_.open_time = value; break;
+                        default: set_float((double)value); break;
+                        }
+                }
+
+                void set_float(const double value)
+                {
+                        if(depth_ != 2 || !is_data_object()) return;
+                        switch(key_) {
+                        case KEY_QUOTE: msg_.quote = value; break;
+                        case KEY_CLOSE: msg_.quote = value; break;
+                        case KEY_OPEN: msg_.open = value; break;
+                        case KEY_HIGH: msg_.high = value; break;
+                        case KEY_LOW: msg_.low = value; break;
+                        case KEY_ASK_PRICE: msg_.ask_price = value; break;
+                        case KEY_PAYOUT: msg_.payout = value; break;
+                        case KEY_EPOCH: msg_.epoch = (unsigned long long)value; break;
+                        case KEY_SPOT_TIME: msg_.epoch = (unsigned long long)value; break;
+                        case KEY_OPEN_TIME: msg_.open_time = (unsigned long long)value; break;
+                        default: break;
+                        }
+                }
+        public:
+                FastMessageParser(FastMessage &msg) : msg_(msg) {};
+
+                bool null() { return true; }
+                bool boolean(bool) { return true; }
+                bool number_integer(json::number_integer_t value)
+                {
+                        if(value >= 0) set_integer((unsigned long long)value);
+                        return true;
+                }
+                bool number_unsigned(json::number_unsigned_t value)
+                {
+                        set_integer(value);
+                        return true;
+                }
+                bool number_float(json::number_float_t value, const json::string_t &)
+                {
+                        set_float(value);
+                        return true;
+                }
+                bool string(json::string_t &value)
+                {
+                        if(depth_ == 1) {
+                                if(top_key_ == KEY_MSG_TYPE) msg_.msg_type = value;
+                                return true;
+                        }
+                        if(depth_ != 2) return true;
+                        if(key_ == KEY_SYMBOL) {
+                                // символ из объекта данных важнее символа из echo_req
+                                if(object_ != KEY_ECHO_REQ || msg_.symbol.empty()) msg_.symbol = value;
+                        } else
+                        if(key_ == KEY_CONTRACT_TYPE) {
+                                if(object_ == KEY_ECHO_REQ) msg_.contract_type = value;
+                        } else
+                        if(key_ == KEY_CODE) {
+                                if(object_ == KEY_ERROR) msg_.error_code = value;
+                        } else
+                        if(key_ == KEY_ID) {
+                                if(object_ == KEY_PROPOSAL) msg_.proposal_id = value;
+                        } else
+                        if(key_ == KEY_EPOCH || key_ == KEY_OPEN_TIME) {
+                                unsigned long long number = 0;
+                                if(parse_number(value.data(), value.data() + value.size(), number))
+                                        set_integer(number);
+                        } else
+                        if(is_data_object()) {
+                                double number = 0;
+                                if(parse_number(value.data(), value.data() + value.size(), number))
+                                        set_float(number);
+                        }
+                        return true;
+                }
+                template <class BINARY_TYPE>
+                bool binary(BINARY_TYPE &) { return true; }
+                bool start_object(std::size_t)
+                {
+                        if(depth_ == 1) {
+                                object_ = top_key_;
+                                if(object_ == KEY_ERROR) msg_.is_error = true;
+                        }
+                        ++depth_;
+                        return true;
+                }
+                bool end_object()
+                {
+                        --depth_;
+                        if(depth_ == 1) object_ = KEY_OTHER;
+                        return true;
+                }
+                bool start_array(std::size_t)
+                {
+                        ++depth_;
+                        return true;
+                }
+                bool end_array()
+                {
+                        --depth_;
+                        return true;
+                }
+                bool key(json::string_t &value)
+                {
+                        if(depth_ == 1) top_key_ = get_key(value);
+                        else if(depth_ == 2) key_ = get_key(value);
+                        return true;
+                }
+                template <class EXCEPTION_TYPE>
+                bool parse_error(std::size_t, const std::string &, const EXCEPTION_TYPE &)
+                {
+                        return false;
+                }
+        };
 
-        std::vector<std::vector<double>> close_data_;
-        std::vector<std::vector<unsigned long long>> time_data_;
-        std::mutex quotations_mutex_;
+        FastMessage fast_message_; // используется только потоком соединения
+        std::string msg_type_; // используется только потоком соединения
+        std::chrono::steady_clock::time_point receive_time_; // время получения текущего сообщения (поток соединения)
+        std::atomic<unsigned long long> message_count_; // количество полученных сообщений
 
-        std::atomic<bool> is_stream_quotations_;
-        std::atomic<bool> is_stream_quotations_error_;
-        std::atomic<bool> is_stream_proposal_;
-        // время сервера
-        std::atomic<unsigned long long> last_time_;
-        std::atomic<bool> is_last_time_;
-        // массив баров для истории
-        std::mutex array_candles_mutex_;
-        json array_candles_;
-        std::atomic<bool> is_array_candles_;
-        std::atomic<bool> is_array_candles_error_;
-        std::atomic<bool> is_send_array_candles_;
-        // массив тиков для истории
-        std::mutex array_ticks_mutex_;
-        json array_ticks_;
-        std::atomic<bool> is_array_ticks_;
-        std::atomic<bool> is_array_ticks_error_;
-        std::atomic<bool> is_send_array_ticks_;
+        // задержка обработчиков событий (наносекунды, индекс - DispatchType)
+        std::atomic<unsigned long long> dispatch_count_[DISPATCH_TYPES_NUM];
+        std::atomic<unsigned long long> dispatch_sum_[DISPATCH_TYPES_NUM];
+        std::atomic<unsigned long long> dispatch_max_[DISPATCH_TYPES_NUM];
+        std::atomic<unsigned long long> dispatch_last_[DISPATCH_TYPES_NUM];
 
-        std::atomic<bool> is_use_log;
-        std::mutex file_log_mutex_;
+        // встроенные обработчики сообщений (индекс - MessageType)
+        typedef void (BinaryAPI::*MessageHandler)(json &j, json::iterator &it_error);
+        MessageHandler message_handlers_[MSG_TYPES_NUM];
+        // обработчики сообщений пользователя (индекс - номер типа сообщения)
+        std::vector<std::function<void(json &)>> user_handlers_;
+        std::unordered_map<std::string, int> user_message_types_; // типы сообщений, неизвестные классу
+        std::atomic<bool> is_user_handler_[MSG_TYPES_NUM];
+        std::mutex user_handlers_mutex_;
 //------------------------------------------------------------------------------
-        std::string format(const char *fmt, ...)
+        /** \brief Получить номер типа сообщения
+         * Для встроенных типов номер совпадает с MessageType, остальные типы
+         * получают номера после MSG_TYPES_NUM при регистрации обработчика пользователя
+         * \param msg_type Тип сообщения
+         * \return номер типа сообщения или MSG_UNKNOWN
+         */
+        int get_message_type(const std::string &msg_type)
         {
-                va_list args;
-                va_start(args, fmt);
-                std::vector<char> v(1024);
-                while (true)
-                {
-                        va_list args2;
-                        va_copy(args2, args);
-                        int res = vsnprintf(v.data(), v.size(), fmt, args2);
-                        if ((res >= 0) && (res < static_cast<int>(v.size())))
-                        {
-                            va_end(args);
-                            va_end(args2);
-                            return std::string(v.data());
+                static const std::unordered_map<std::string, int> message_types = {
+                        {"tick", MSG_TICK}, {"ohlc", MSG_OHLC}, {"proposal", MSG_PROPOSAL},
+                        {"candles", MSG_CANDLES}, {"history", MSG_HISTORY}, {"time", MSG_TIME},
+                        {"authorize", MSG_AUTHORIZE}, {"buy", MSG_BUY}, {"sell", MSG_SELL},
+                        {"proposal_open_contract", MSG_PROPOSAL_OPEN_CONTRACT},
+                        {"balance", MSG_BALANCE}, {"transaction", MSG_TRANSACTION},
+                        {"portfolio", MSG_PORTFOLIO}, {"ping", MSG_PING},
+                        {"forget", MSG_FORGET}, {"forget_all", MSG_FORGET_ALL},
+                        {"active_symbols", MSG_ACTIVE_SYMBOLS},
+                };
+                auto it_type = message_types.find(msg_type);
+                if(it_type != message_types.end())
+                        return it_type->second;
+                std::lock_guard<std::mutex> lock(user_handlers_mutex_);
+                auto it_user_type = user_message_types_.find(msg_type);
+                if(it_user_type != user_message_types_.end())
+                        return it_user_type->second;
+                return MSG_UNKNOWN;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Вызвать обработчик сообщений пользователя
+         * \param type Номер типа сообщения
+         * \param j Сообщение
+         */
+        void call_user_handler(const int type, json &j)
+        {
+                if(type < MSG_TYPES_NUM && !is_user_handler_[type])
+                        return;
+                std::function<void(json &)> handler;
+                user_handlers_mutex_.lock();
+                if(type < (int)user_handlers_.size())
+                        handler = user_handlers_[type];
+                user_handlers_mutex_.unlock();
+                if(handler) handler(j);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Учесть задержку обработчика события
+         * Задержка отсчитывается от получения сообщения (receive_time_)
+         * \param type Тип события (см. DispatchType)
+         */
+        void add_dispatch_latency(const int type)
+        {
+                const unsigned long long latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - receive_time_).count();
+                dispatch_count_[type].fetch_add(1, std::memory_order_relaxed);
+                dispatch_sum_[type].fetch_add(latency, std::memory_order_relaxed);
+                dispatch_last_[type].store(latency, std::memory_order_relaxed);
+                if(latency > dispatch_max_[type].load(std::memory_order_relaxed))
+                        dispatch_max_[type].store(latency, std::memory_order_relaxed);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Добавить бары в поток котировок
+         * Если бары продолжают данные буфера (первый бар не новее последнего бара буфера),
+         * новые бары дописываются, а последний бар буфера обновляется. Иначе бары заменяют содержимое буфера
+         * \param symbol Символ
+         * \param bars Бары
+         */
+        void merge_quotes(const std::string &symbol, const std::vector<QuotationBar> &bars)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end() || it_symbol->second >= (int)quotes_.size())
+                        return;
+                RingBuffer<QuotationBar> &quotes = *quotes_[it_symbol->second];
+                QuotationBar last = QuotationBar();
+                if(bars.size() == 0 || !quotes.back(last) || bars.front().timestamp > last.timestamp) {
+                        quotes.assign(bars.data(), bars.size());
+                        return;
+                }
+                for(size_t i = 0; i < bars.size(); ++i) {
+                        if(bars[i].timestamp == last.timestamp) {
+                                quotes.update_back(bars[i]);
+                        } else
+                        if(bars[i].timestamp > last.timestamp) {
+                                quotes.push(bars[i]);
+                                last = bars[i];
                         }
-                        size_t size;
-                        if (res < 0)
-                            size = v.size() * 2;
-                        else
-                            size = static_cast<size_t>(res) + 1;
-                        v.clear();
-                        v.resize(size);
-                        va_end(args2);
                 }
         }
 //------------------------------------------------------------------------------
-        inline void send_message_thread_delay(std::string &message, const int delay)
+        /// Создать буферы агрегатора тиков (нужно вызывать под исключительной блокировкой map_symbol_mutex_)
+        void reset_aggregator()
         {
-                std::thread([&, message, delay]{
-                        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
-                        send_queue_mutex_.lock();
-                        send_queue_.push(message);
-                        send_queue_mutex_.unlock();
-                }).detach();
+                aggregated_.clear();
+                for(size_t i = 0; i < symbols_.size(); ++i) {
+                        for(size_t n = 0; n < aggregator_periods_.size(); ++n) {
+                                aggregated_.emplace_back(new RingBuffer<CandleBar>(aggregator_capacity_));
+                        }
+                }
         }
 //------------------------------------------------------------------------------
-        inline void send_message(std::string &message)
+        /** \brief Найти буфер баров агрегатора (нужно вызывать под map_symbol_mutex_)
+         * \param symbol Символ
+         * \param period Период баров
+         * \param bars Буфер баров
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int find_aggregated_candles(const std::string &symbol,
+                                    const unsigned long long period,
+                                    RingBuffer<CandleBar> *&bars)
         {
-                send_queue_mutex_.lock();
-                send_queue_.push(message);
-                send_queue_mutex_.unlock();
+                const size_t periods = aggregator_periods_.size();
+                if(periods == 0)
+                        return NO_INIT;
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end())
+                        return INVALID_PARAMETER;
+                auto it_period = std::find(aggregator_periods_.begin(), aggregator_periods_.end(), period);
+                if(it_period == aggregator_periods_.end())
+                        return INVALID_PARAMETER;
+                const size_t indx = it_symbol->second * periods + (it_period - aggregator_periods_.begin());
+                if(indx >= aggregated_.size())
+                        return NO_INIT;
+                bars = aggregated_[indx].get();
+                return OK;
         }
 //------------------------------------------------------------------------------
-        int send_json_with_authorize(json &j)
+        /** \brief Добавить тик в бары агрегатора
+         * Нужно вызывать под map_symbol_mutex_. Тики старше текущего бара пропускаются
+         * \param indx Номер валютной пары
+         * \param epoch Время тика
+         * \param quote Котировка
+         */
+        void aggregate_tick(const size_t indx,
+                            const unsigned long long epoch,
+                            const double quote)
         {
-                if(is_authorize_) {
-                        std::string message = j.dump();
-                        send_queue_mutex_.lock();
-                        send_queue_.push(message);
-                        send_queue_mutex_.unlock();
-                        return OK;
+                const size_t periods = aggregator_periods_.size();
+                if(periods == 0 || (indx + 1) * periods > aggregated_.size())
+                        return;
+                for(size_t n = 0; n < periods; ++n) {
+                        RingBuffer<CandleBar> &bars = *aggregated_[indx * periods + n];
+                        const unsigned long long timestamp = (epoch / aggregator_periods_[n]) * aggregator_periods_[n];
+                        CandleBar bar = CandleBar();
+                        const bool is_bar = bars.back(bar);
+                        if(is_bar && bar.timestamp == timestamp) {
+                                bar.high = std::max(bar.high, quote);
+                                bar.low = std::min(bar.low, quote);
+                                bar.close = quote;
+                                ++bar.ticks;
+                                bars.update_back(bar);
+                        } else
+                        if(!is_bar || bar.timestamp < timestamp) {
+                                bar.timestamp = timestamp;
+                                bar.open = bar.high = bar.low = bar.close = quote;
+                                bar.ticks = 1;
+                                bars.push(bar);
+                        }
                 }
-                return NO_AUTHORIZATION;
         }
 //------------------------------------------------------------------------------
-        int send_json(json &j)
+        static inline double get_local_seconds(const std::chrono::steady_clock::time_point time)
         {
-                if(is_open_connection_) {
-                        std::string message = j.dump();
-                        send_queue_mutex_.lock();
-                        send_queue_.push(message);
-                        send_queue_mutex_.unlock();
-                        return OK;
+                return std::chrono::duration<double>(time.time_since_epoch()).count();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Учесть время сервера из потока (тик, свеча, процент выплат) в оценке времени сервера
+         * Самую сильную границу дает первое сообщение с новым временем, поэтому
+         * оценка обновляется не чаще раза в секунду времени сервера
+         */
+        inline void add_server_clock_epoch(const unsigned long long epoch)
+        {
+                if(epoch <= last_clock_epoch_) return;
+                last_clock_epoch_ = epoch;
+                std::lock_guard<std::mutex> lock(server_clock_mutex_);
+                server_clock_.add_epoch(get_local_seconds(receive_time_), (double)epoch);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Запросить время сервера, если оценка стала неточной
+         * Пока ответов мало, время запрашивается чаще, затем не чаще раза в минуту
+         */
+        void check_server_clock_sync()
+        {
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                {
+                        std::lock_guard<std::mutex> lock(server_clock_mutex_);
+                        double server_time = 0, error = 0;
+                        if(server_clock_.get(get_local_seconds(now), server_time, error) &&
+                           error <= BINARY_API_SERVER_CLOCK_MAX_ERROR)
+                                return;
+                        const std::chrono::milliseconds period(server_clock_.get_num_responses() < 5 ? 1300 : 60000);
+                        if(is_clock_sync_ && now - last_clock_sync_ < period)
+                                return;
+                        if(!is_open_connection_)
+                                return;
+                        last_clock_sync_ = now;
+                        is_clock_sync_ = true;
                 }
-                return NO_OPEN_CONNECTION;
+                request_servertime();
         }
 //------------------------------------------------------------------------------
-        void write_log_file(std::string file_name, std::string message)
+        /** \brief Обработать новую котировку тикового потока
+         * \param symbol Символ
+         * \param epoch Время тика
+         * \param quote Котировка
+         */
+        void process_tick(const std::string &symbol,
+                          const unsigned long long epoch,
+                          const double quote)
         {
-                if(is_use_log) {
-                        std::thread([&, file_name, message]{
-                                file_log_mutex_.lock();
-                                try {
-                                        std::ofstream file(file_name, std::ios::app);
-                                        if(file) {
-                                                file << message << std::endl;
-                                        }
-                                        file.close();
-                                }
-                                catch(...) {
+                const unsigned long long lastepoch = (epoch/60)*60; // время открытия бара тика
 
-                                }
-                                file_log_mutex_.unlock();
-                        }).detach();
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end() || it_symbol->second >= (int)quotes_.size())
+                        return;
+                const size_t indx = it_symbol->second;
+                RingBuffer<QuotationBar> &quotes = *quotes_[indx];
+
+                QuotationBar bar = QuotationBar();
+                const bool is_bar = quotes.back(bar);
+                const QuotationBar close_bar = bar;
+                bool is_close = false;
+                if(is_bar && lastepoch <= bar.timestamp) {
+                        bar.high = std::max(bar.high, quote);
+                        bar.low = std::min(bar.low, quote);
+                        bar.close = quote;
+                        quotes.update_back(bar);
+                } else {
+                        is_close = is_bar;
+                        bar.timestamp = lastepoch;
+                        bar.open = bar.high = bar.low = bar.close = quote;
+                        quotes.push(bar);
+                }
+                aggregate_tick(indx, epoch, quote);
+                lock.unlock();
+
+                const unsigned long long _last_time_ = last_time_;
+                last_time_ = std::max(epoch, _last_time_);
+                is_last_time_ = true;
+                add_server_clock_epoch(epoch);
+
+                if(is_close && on_candle_close) {
+                        on_candle_close(indx, symbol, close_bar);
+                        add_dispatch_latency(DISPATCH_CANDLE_CLOSE);
+                }
+                if(on_tick) {
+                        on_tick(indx, symbol, epoch, quote);
+                        add_dispatch_latency(DISPATCH_TICK);
                 }
         }
 //------------------------------------------------------------------------------
-        void write_log_file(std::string message)
+        /** \brief Обработать обновление свечи потока ohlc
+         * \param symbol Символ
+         * \param open_time Время открытия свечи
+         * \param epoch Время последнего тика
+         * \param open Цена открытия свечи
+         * \param high Максимальная цена свечи
+         * \param low Минимальная цена свечи
+         * \param close Цена закрытия свечи
+         */
+        void process_ohlc(const std::string &symbol,
+                          const unsigned long long open_time,
+                          const unsigned long long epoch,
+                          const double open,
+                          const double high,
+                          const double low,
+                          const double close)
         {
-                if(!is_use_log)
+                // находим номер валютной пары
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end() || it_symbol->second >= (int)quotes_.size())
                         return;
-                std::string str_line = "//------------------------------------------------------------------------------\n";
-                std::string error_message = str_line +
-                        "start of error message (" +
-                        xtime::get_str_date_time() + "):\n" +
-                        message + "\nend of error message\n" + str_line;
-                write_log_file(log_file_name, error_message);
+                const size_t indx = it_symbol->second;
+                RingBuffer<QuotationBar> &quotes = *quotes_[indx];
+
+                QuotationBar bar = QuotationBar();
+                const bool is_bar = quotes.back(bar);
+                const QuotationBar close_bar = bar;
+                bool is_close = false;
+                if(is_bar && bar.timestamp == open_time) {
+                        bar.open = open;
+                        bar.high = high;
+                        bar.low = low;
+                        bar.close = close;
+                        quotes.update_back(bar);
+                } else
+                if(!is_bar || bar.timestamp < open_time) {
+                        is_close = is_bar;
+                        bar.timestamp = open_time;
+                        bar.open = open;
+                        bar.high = high;
+                        bar.low = low;
+                        bar.close = close;
+                        quotes.push(bar);
+                }
+                // каждое обновление потока ohlc соответствует новому тику
+                aggregate_tick(indx, epoch, close);
+                lock.unlock();
+
+                const unsigned long long _last_time_ = last_time_;
+                last_time_ = std::max(epoch, _last_time_);
+                is_last_time_ = true;
+                add_server_clock_epoch(epoch);
+
+                if(is_close && on_candle_close) {
+                        on_candle_close(indx, symbol, close_bar);
+                        add_dispatch_latency(DISPATCH_CANDLE_CLOSE);
+                }
         }
 //------------------------------------------------------------------------------
-        bool check_time_message(json &j,
-                                json::iterator &it_msg_type,
-                                json::iterator &it_error)
+        /** \brief Добавить значение в историю процентов выплат (только поток соединения)
+         * Значения с тем же временем заменяют последнее, значения из прошлого пропускаются,
+         * чтобы время в истории не убывало
+         * \param history История процентов выплат
+         * \param timestamp Время сервера. Если 0, берется время компьютера
+         * \param payout Процент выплат
+         */
+        static void add_payout(RingBuffer<PayoutPoint> &history, unsigned long long timestamp, const double payout)
         {
-                if(*it_msg_type == "time") {
-                        if(it_error != j.end()) {
-                                // попробуем еще раз
-                                std::string message = j["echo_req"].dump();
-                                if((*it_error)["code"] == "RateLimit") {
-                                        // отправим сообщение повторно с задержкой
-                                        send_message_thread_delay(message, 1000);
-                                } else {
-                                        send_message(message);
-                                }
-                        } else {
-                                last_time_ = j["time"];
-                                is_last_time_ = true;
+                if(timestamp == 0) {
+                        timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::system_clock::now().time_since_epoch()).count();
+                }
+                const PayoutPoint point{timestamp, payout};
+                PayoutPoint last;
+                if(!history.back(last) || last.timestamp < timestamp) {
+                        history.push(point);
+                } else
+                if(last.timestamp == timestamp) {
+                        history.update_back(point);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Найти историю процентов выплат (нужно вызывать под map_symbol_mutex_)
+         * \param symbol Символ
+         * \param contract_type Тип контракта (см. ContractType)
+         * \return указатель на историю или nullptr
+         */
+        RingBuffer<PayoutPoint> *find_payouts(const std::string &symbol, const int contract_type)
+        {
+                if(contract_type != BUY && contract_type != SELL) return nullptr;
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end()) return nullptr;
+                const size_t indx = 2 * it_symbol->second + (contract_type == BUY ? 0 : 1);
+                if(indx >= payouts_.size()) return nullptr;
+                return payouts_[indx].get();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Обработать обновление потока процентов выплат
+         * \param symbol Символ
+         * \param contract_type Тип контракта (CALL или PUT)
+         * \param payout_ratio Процент выплат
+         * \param proposal_id Идентификатор предложения (пустая строка, если предложения нет)
+         * \param ask_price Цена контракта
+         * \param timestamp Время сервера
+         * \return вернет true, если это первое обновление подписки (сервер принял подписку)
+         */
+        bool process_proposal(const std::string &symbol,
+                              const std::string &contract_type,
+                              const double payout_ratio,
+                              const std::string &proposal_id,
+                              const double ask_price,
+                              const unsigned long long timestamp)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end()) return false;
+                const size_t indx = it_symbol->second;
+                if(!proposal_id.empty()) {
+                        const int direction = contract_type == "CALL" ? 0 : contract_type == "PUT" ? 1 : -1;
+                        if(direction >= 0 && (size_t)(2 * indx + direction) < payouts_.size()) {
+                                add_payout(*payouts_[2 * indx + direction], timestamp, payout_ratio);
                         }
-                        return true;
-                } else {
+                }
+                lock.unlock();
+                add_server_clock_epoch(timestamp);
+                if(contract_type != "CALL" && contract_type != "PUT")
+                        return false;
+                const bool is_buy = contract_type == "CALL";
+                proposal_mutex_.lock();
+                std::vector<double> &proposal = is_buy ? proposal_buy_ : proposal_sell_;
+                std::vector<ProposalId> &ids = is_buy ? proposal_buy_ids_ : proposal_sell_ids_;
+                // init_symbols мог изменить размер массивов после поиска номера валютной пары
+                if(indx >= proposal.size() || indx >= ids.size()) {
+                        proposal_mutex_.unlock();
                         return false;
                 }
+                proposal[indx] = payout_ratio;
+                const bool is_accepted = !ids[indx].is_live && !proposal_id.empty();
+                ids[indx].id = proposal_id;
+                ids[indx].ask_price = ask_price;
+                ids[indx].is_live = !proposal_id.empty();
+                proposal_mutex_.unlock();
+                if(on_proposal) {
+                        on_proposal(indx, symbol, contract_type, payout_ratio);
+                        add_dispatch_latency(DISPATCH_PROPOSAL);
+                }
+                return is_accepted;
         }
 //------------------------------------------------------------------------------
-        bool check_tick_message(json &j,
-                                json::iterator &it_msg_type,
-                                json::iterator &it_error)
+        /** \brief Обработать сообщение без построения json
+         * Обрабатываются только сообщения tick, ohlc и proposal без ошибок
+         * \param str Сообщение
+         * \return вернет true, если сообщение было обработано
+         */
+        bool parse_fast_json(const std::string &str, const int type)
         {
-                if(*it_msg_type == "tick") {
-                        if(it_error != j.end()) {
-                                if((*it_error)["code"] != "AlreadySubscribed") {
-                                        // попробуем еще раз
-                                        std::string message = j["echo_req"].dump();
-                                        if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
-                                                send_message_thread_delay(message, 1000);
-                                        } else {
-                                                send_message(message);
-                                        }
-                                }
-                        } else {
-                                auto it_tick = j.find("tick");
-                                const double quote = atof(((*it_tick)["quote"].get<std::string>()).c_str());              // котировка
-                                const unsigned long long epoch = atoi(((*it_tick)["epoch"].get<std::string>()).c_str());  // время
-                                const std::string symbol = (*it_tick)["symbol"];                                          // символ
-                                const unsigned long long lastepoch = (epoch/60)*60;                                               // время послденей закрытой свечи
-
-                                map_symbol_mutex_.lock();
-                                auto it_symbol = map_symbol_.find(symbol);
-                                if(it_symbol == map_symbol_.end()) {
-                                        map_symbol_mutex_.unlock();
-                                        return true;
-                                }
-                                const int indx = it_symbol->second;
-                                map_symbol_mutex_.unlock();
-
-                                quotations_mutex_.lock();
-                                const size_t data_size = close_data_.size();
-                                if(indx < (int)data_size) {
-                                        if(epoch % 60 == 0) {
-                                                close_data_.at(indx).push_back(quote);
-                                                time_data_.at(indx).push_back(epoch);
-                                        } else
-                                        if(close_data_[indx].size() > 0) {
-                                                if(lastepoch > time_data_.at(indx).back()) {
-                                                        close_data_.at(indx).push_back(quote);
-                                                        time_data_.at(indx).push_back(lastepoch);
-                                                } else {
-                                                        close_data_.at(indx).at(close_data_.at(indx).size() - 1) = quote;
-                                                }
-                                        } else {
-                                                close_data_.at(indx).push_back(quote);
-                                                time_data_.at(indx).push_back(lastepoch);
-                                        }
-                                        unsigned long long _last_time_ = last_time_;
-                                        last_time_ = std::max(epoch, _last_time_);
-                                        is_last_time_ = true;
-                                } // if
-                                quotations_mutex_.unlock();
-                        }
+                // большие редкие сообщения (например, history) не разбираем дважды,
+                // а если есть обработчик пользователя, ему нужен json
+                if(type != MSG_TICK && type != MSG_OHLC && type != MSG_PROPOSAL)
+                        return false;
+                if(is_user_handler_[type])
+                        return false;
+                if(!parse_fast_message(str, fast_message_) || fast_message_.is_error)
+                        return false;
+                FastMessage &msg = fast_message_;
+                switch(type) {
+                case MSG_TICK:
+                        process_tick(msg.symbol, msg.epoch, msg.quote);
                         return true;
-                } else {
+                case MSG_OHLC:
+                        process_ohlc(msg.symbol, msg.open_time, msg.epoch, msg.open, msg.high, msg.low, msg.quote);
+                        return true;
+                case MSG_PROPOSAL:
+                        if(msg.subscribe == 1) {
+                                const double payout_ratio = msg.ask_price != 0 ? (msg.payout/msg.ask_price) - 1 : 0.0;
+                                // принятая сервером подписка увеличивает лимит подписок
+                                if(process_proposal(msg.symbol, msg.contract_type, payout_ratio, msg.proposal_id, msg.ask_price, msg.epoch))
+                                        adapt_send_rate(false, true);
+                                return true;
+                        }
+                        return false;
+                default:
                         return false;
                 }
         }
 //------------------------------------------------------------------------------
-        bool check_ohlc_message(json &j,
-                                json::iterator &it_msg_type,
-                                json::iterator &it_error)
+        void check_time_message(json &j, json::iterator &it_error)
         {
-                if(*it_msg_type == "ohlc") {
-                        if(it_error != j.end()) {
-                                if((*it_error)["code"] != "AlreadySubscribed") {
-                                        if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
-                                                // попробуем еще раз
-                                                std::string message = j["echo_req"].dump();
-                                                send_message_thread_delay(message, 1000);
-                                        } else {
-                                                is_stream_quotations_error_ = true;
-                                        }
-                                }
-                                return true;
+                if(it_error != j.end()) {
+                        // попробуем еще раз
+                        std::string message = j["echo_req"].dump();
+                        if((*it_error)["code"] == "RateLimit") {
+                                // отправим сообщение повторно с задержкой
+                                send_message_delay(message, 1000, get_send_priority(j["echo_req"]));
                         } else {
-                                auto it_ohlc = j.find("ohlc");
-                                const unsigned long long open_time = (*it_ohlc)["open_time"];
-                                const unsigned long long epoch = (*it_ohlc)["epoch"];
-                                const double _close = atof(((*it_ohlc)["close"].get<std::string>()).c_str());
-                                const std::string symbol = (*it_ohlc)["symbol"];
-                                // находим номер валютной пары
-                                map_symbol_mutex_.lock();
-                                auto it_symbol = map_symbol_.find(symbol);
-                                if(it_symbol == map_symbol_.end()) {
-                                        map_symbol_mutex_.unlock();
-                                        return true;
-                                }
-                                const int indx = it_symbol->second;
-                                map_symbol_mutex_.unlock();
-
-                                quotations_mutex_.lock();
-                                const unsigned long long last_open_time = time_data_[indx].back();
-                                const int data_size = close_data_[indx].size();
-                                if(indx < data_size) {
-                                        if(close_data_[indx].size() > 0) {
-                                                if(last_open_time == open_time) {
-                                                        close_data_[indx][data_size - 1] = _close;
-                                                } else
-                                                if(last_open_time < open_time) {
-                                                        close_data_[indx].push_back(_close);
-                                                        time_data_[indx].push_back(open_time);
-                                                }
-                                        } else {
-                                                close_data_[indx].push_back(_close);
-                                                time_data_[indx].push_back(open_time);
-                                        }
-                                }
-                                quotations_mutex_.unlock();
-
-                                const unsigned long long _last_time_ = last_time_;
-                                last_time_ = std::max(epoch, _last_time_);
-                                is_last_time_ = true;
+                                send_message(message, 0, get_send_priority(j["echo_req"]));
                         }
-                        return true;
                 } else {
-                        return false;
+                        last_time_ = j["time"];
+                        is_last_time_ = true;
+                        std::lock_guard<std::mutex> lock(server_clock_mutex_);
+                        if(is_time_request_send_) {
+                                server_clock_.add_response(get_local_seconds(time_request_send_),
+                                                           get_local_seconds(receive_time_), (double)last_time_);
+                        } else {
+                                // повтор запроса без req_id: известно только, что это время уже наступило
+                                server_clock_.add_epoch(get_local_seconds(receive_time_), (double)last_time_);
+                        }
+                        is_time_request_send_ = false;
+                        // после ответа time снова учитываем любое время из потоков (часы сервера могли быть переведены)
+                        last_clock_epoch_ = 0;
                 }
         }
 //------------------------------------------------------------------------------
-        bool check_candles_message(json &j,
-                                   json::iterator &it_msg_type,
-                                   json::iterator &it_error)
+        void check_tick_message(json &j, json::iterator &it_error)
         {
-                if(*it_msg_type == "candles") {
-                        if(it_error != j.end()) {
-                                if((*it_error)["code"] != "AlreadySubscribed") {
-                                        if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
-                                                // попробуем еще раз
-                                                std::string message = j["echo_req"].dump();
-                                                send_message_thread_delay(message, 1000);
-                                        } else {
-                                                if(j["echo_req"]["subscribe"] != 1) {
-                                                        is_array_candles_ = true;
-                                                        is_array_candles_error_ = true;
-                                                } else {
-                                                        is_stream_quotations_error_ = true;
-                                                }
-                                        }
-                                }
-                                return true;
-                        } else {
-                                auto j_echo_req = j.find("echo_req");
-                                if((*j_echo_req)["subscribe"] == 1) {
-                                        std::string symbol = (*j_echo_req)["ticks_history"];                                          // символ
-                                        // находим номер валютной пары
-                                        map_symbol_mutex_.lock();
-                                        auto it_symbol = map_symbol_.find(symbol);
-                                        if(it_symbol == map_symbol_.end()) {
-                                                map_symbol_mutex_.unlock();
-                                                return true;
-                                        }
-                                        const int indx = it_symbol->second;
-                                        map_symbol_mutex_.unlock();
-
-                                        // инициализируем массив свечей
-                                        auto it_candles = j.find("candles");
-                                        json &j_candles = *it_candles;
-
-                                        const size_t candles_num = j_candles.size();
-                                        quotations_mutex_.lock();
-                                        close_data_[indx].resize(candles_num);
-                                        time_data_[indx].resize(candles_num);
-                                        for(size_t i = 0; i < candles_num; i++) {
-                                                json &_j = j_candles[i];
-                                                close_data_[indx][i] = atof((_j["close"].get<std::string>()).c_str());
-                                                std::string timestr = _j["epoch"].dump();
-                                                time_data_[indx][i] = atoi(timestr.c_str());
-                                        }
-                                        quotations_mutex_.unlock();
-                                        return true;
+                if(it_error != j.end()) {
+                        if((*it_error)["code"] != "AlreadySubscribed") {
+                                // попробуем еще раз
+                                std::string message = j["echo_req"].dump();
+                                if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
+                                        send_message_delay(message, 1000, get_send_priority(j["echo_req"]));
                                 } else {
-                                        auto it_candles = j.find("candles");
-
-                                        array_candles_mutex_.lock();
-                                        if(it_candles != j.end())
-                                                array_candles_ = *it_candles;
-                                        array_candles_mutex_.unlock();
-                                        is_array_candles_ = true;
-                                        is_array_candles_error_ = false;
+                                        send_message(message, 0, get_send_priority(j["echo_req"]));
                                 }
                         }
-                        return true;
                 } else {
-                        return false;
+                        auto it_tick = j.find("tick");
+                        double quote = 0;               // котировка
+                        unsigned long long epoch = 0;   // время
+                        if(!get_number((*it_tick)["quote"], quote) ||
+                           !get_number((*it_tick)["epoch"], epoch))
+                                return;
+                        const std::string &symbol = (*it_tick)["symbol"].get_ref<const std::string &>(); // символ
+                        process_tick(symbol, epoch, quote);
                 }
         }
 //------------------------------------------------------------------------------
-        bool check_history_message(json &j,
-                                   json::iterator &it_msg_type,
-                                   json::iterator &it_error)
+        void check_ohlc_message(json &j, json::iterator &it_error)
         {
-                if(*it_msg_type == "history") {
-                        if(it_error != j.end()) {
-                                if((*it_error)["code"] != "AlreadySubscribed") {
-                                        if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
-                                                // попробуем еще раз
-                                                std::string message = j["echo_req"].dump();
-                                                send_message_thread_delay(message, 1000);
-                                        } else {
-                                                if(j["echo_req"]["subscribe"] != 1) {
-                                                        is_array_ticks_ = true;
-                                                        is_array_ticks_error_ = true;
-                                                } else {
-                                                        is_stream_quotations_error_ = true;
-                                                }
-                                        }
-                                }
-                                return true;
-                        } else {
-                                auto j_echo_req = j.find("echo_req");
-                                if((*j_echo_req)["subscribe"] == 1) {
-                                        // тиковый поток
-                                        return true;
+                if(it_error != j.end()) {
+                        if((*it_error)["code"] != "AlreadySubscribed") {
+                                if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
+                                        // попробуем еще раз
+                                        std::string message = j["echo_req"].dump();
+                                        send_message_delay(message, 1000, get_send_priority(j["echo_req"]));
                                 } else {
-                                        auto it_history = j.find("history");
-
-                                        array_ticks_mutex_.lock();
-                                        if(it_history != j.end())
-                                                array_ticks_ = *it_history;
-                                        array_ticks_mutex_.unlock();
-                                        is_array_ticks_ = true;
-                                        is_array_ticks_error_ = false;
+                                        is_stream_quotations_error_ = true;
                                 }
                         }
-                        return true;
                 } else {
-                        return false;
+                        auto it_ohlc = j.find("ohlc");
+                        unsigned long long open_time = 0;
+                        unsigned long long epoch = 0;
+                        double _open = 0, _high = 0, _low = 0, _close = 0;
+                        if(!get_number((*it_ohlc)["open_time"], open_time) ||
+                           !get_number((*it_ohlc)["epoch"], epoch) ||
+                           !get_number((*it_ohlc)["open"], _open) ||
+                           !get_number((*it_ohlc)["high"], _high) ||
+                           !get_number((*it_ohlc)["low"], _low) ||
+                           !get_number((*it_ohlc)["close"], _close))
+                                return;
+                        const std::string &symbol = (*it_ohlc)["symbol"].get_ref<const std::string &>();
+                        process_ohlc(symbol, open_time, epoch, _open, _high, _low, _close);
                 }
         }
 //------------------------------------------------------------------------------
-        bool check_authorize_message(json &j,
-                                     json::iterator &it_msg_type,
-                                     json::iterator &it_error)
+        void check_candles_message(json &j, json::iterator &it_error)
         {
-                // получили сообщение авторизации
-                if(*it_msg_type == "authorize") {
-                        if(it_error != j.end()) {
-                                // попробуем еще раз залогиниться
-                                std::string message = j["echo_req"].dump();
-                                if((*it_error)["code"] == "RateLimit") {
-                                        send_message_thread_delay(message, 1000);
+                if(it_error != j.end()) {
+                        if((*it_error)["code"] != "AlreadySubscribed") {
+                                if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
+                                        // попробуем еще раз
+                                        std::string message = j["echo_req"].dump();
+                                        send_message_delay(message, 1000, get_send_priority(j["echo_req"]));
                                 } else {
-                                        if((*it_error)["code"] == "InvalidToken") {
-                                                is_error_token_ = true;
-                                                return true;
+                                        if(j["echo_req"]["subscribe"] != 1) {
+                                                complete_request(j);
+                                        } else {
+                                                is_stream_quotations_error_ = true;
                                         }
-                                        send_message(message);
                                 }
-                                is_authorize_ = false;
-                        } else {
-                                balance_ = atof((j["authorize"]["balance"].get<std::string>()).c_str());
-                                authorize_mutex_.lock();
-                                currency_ = j["authorize"]["currency"];
-                                authorize_mutex_.unlock();
-                                is_authorize_ = true;
-                                //a_mutex_.unlock();
                         }
-                        return true;
                 } else {
-                        return false;
+                        auto j_echo_req = j.find("echo_req");
+                        if((*j_echo_req)["subscribe"] == 1) {
+                                std::string symbol = (*j_echo_req)["ticks_history"];                                          // символ
+                                // инициализируем массив свечей
+                                auto it_candles = j.find("candles");
+                                json &j_candles = *it_candles;
+
+                                const size_t candles_num = j_candles.size();
+                                std::vector<QuotationBar> bars(candles_num);
+                                for(size_t i = 0; i < candles_num; i++) {
+                                        json &_j = j_candles[i];
+                                        get_number(_j["open"], bars[i].open);
+                                        get_number(_j["high"], bars[i].high);
+                                        get_number(_j["low"], bars[i].low);
+                                        get_number(_j["close"], bars[i].close);
+                                        get_number(_j["epoch"], bars[i].timestamp);
+                                }
+                                merge_quotes(symbol, bars);
+                        } else {
+                                complete_request(j);
+                        }
                 }
         }
 //------------------------------------------------------------------------------
-        bool check_proposal_message(json &j,
-                                    json::iterator &it_msg_type,
-                                    json::iterator &it_error)
+        void check_history_message(json &j, json::iterator &it_error)
         {
-                auto it_echo_req = j.find("echo_req");
-                if(*it_msg_type == "proposal" &&
-                        (*it_echo_req)["subscribe"] == 1) {
-                        std::string _symbol = (*it_echo_req)["symbol"];
-                        map_symbol_mutex_.lock();
-                        auto it_symbol = map_symbol_.find(_symbol);
-                        if(it_symbol != map_symbol_.end()) {
-                                const int indx = it_symbol->second;
-                                map_symbol_mutex_.unlock();
-                                double temp = 0.0;
-                                if(it_error == j.end()) {
-                                        auto it_proposal = j.find("proposal");
-                                        const double ask_price = atof(((*it_proposal)["ask_price"].get<std::string>()).c_str());
-                                        const double payout = atof(((*it_proposal)["payout"].get<std::string>()).c_str());
-                                        temp = ask_price != 0 ? (payout/ask_price) - 1 : 0.0;
-                                } else {
-                                        if((*it_error)["code"] == "AlreadySubscribed") {
-                                                return true;
-                                        }
-                                        // отправим сообщение о подписки на выплаты
+                if(it_error != j.end()) {
+                        if((*it_error)["code"] != "AlreadySubscribed") {
+                                if((*it_error)["code"] == "RateLimit" || (*it_error)["code"] ==  "MarketIsClosed") {
+                                        // попробуем еще раз
                                         std::string message = j["echo_req"].dump();
-                                        if((*it_error)["code"] == "RateLimit" ||
-                                          (*it_error)["code"] == "ContractBuyValidationError") {
-                                                // отправляем сообщение с задержкой
-                                                send_message_thread_delay(message, 2500);
+                                        send_message_delay(message, 1000, get_send_priority(j["echo_req"]));
+                                } else {
+                                        if(j["echo_req"]["subscribe"] != 1) {
+                                                complete_request(j);
                                         } else {
-                                                // отправляем сообщение мгновенно
-                                                send_message(message);
+                                                is_stream_quotations_error_ = true;
                                         }
                                 }
-                                //std::cout << "6" << std::endl;
-                                auto it_contract_type = (*it_echo_req).find("contract_type");
-                                if(*it_contract_type == "CALL") {
-                                        proposal_mutex_.lock();
-                                        proposal_buy_.at(indx) = temp;
-                                        proposal_mutex_.unlock();
-                                } else
-                                if(*it_contract_type == "PUT") {
-                                        proposal_mutex_.lock();
-                                        proposal_sell_.at(indx) = temp;
-                                        proposal_mutex_.unlock();
-                                } // if
+                        }
+                } else {
+                        auto j_echo_req = j.find("echo_req");
+                        if((*j_echo_req)["subscribe"] == 1) {
+                                // тиковый поток
+                                return;
                         } else {
-                                map_symbol_mutex_.unlock();
+                                complete_request(j);
                         }
-                        return true;
+                }
+        }
+//------------------------------------------------------------------------------
+        void check_authorize_message(json &j, json::iterator &it_error)
+        {
+                // получили сообщение авторизации
+                if(it_error != j.end()) {
+                        // попробуем еще раз залогиниться
+                        std::string message = j["echo_req"].dump();
+                        if((*it_error)["code"] == "RateLimit") {
+                                send_message_delay(message, 1000, get_send_priority(j["echo_req"]));
+                        } else {
+                                if((*it_error)["code"] == "InvalidToken") {
+                                        is_error_token_ = true;
+                                        notify_ready();
+                                        return;
+                                }
+                                send_message(message, 0, get_send_priority(j["echo_req"]));
+                        }
+                        is_authorize_ = false;
                 } else {
-                        return false;
+                        double balance = 0;
+                        get_number(j["authorize"]["balance"], balance);
+                        balance_ = balance;
+                        authorize_mutex_.lock();
+                        currency_ = j["authorize"]["currency"];
+                        authorize_mutex_.unlock();
+                        is_authorize_ = true;
+                        //a_mutex_.unlock();
+                        notify_ready();
+                }
+        }
+//------------------------------------------------------------------------------
+        /// Вызвать обработчик разрыва соединения
+        void call_disconnect_handler()
+        {
+                // обработчик вызывается под блокировкой, чтобы после set_disconnect_handler
+                // старый обработчик уже не выполнялся
+                std::lock_guard<std::mutex> lock(disconnect_mutex_);
+                if(on_disconnect) on_disconnect();
+        }
+//------------------------------------------------------------------------------
+        void check_proposal_message(json &j, json::iterator &it_error)
+        {
+                auto it_echo_req = j.find("echo_req");
+                if((*it_echo_req)["subscribe"] != 1) {
+                        // разовый запрос процентов выплат
+                        complete_request(j);
+                        return;
+                }
+                std::string _symbol = (*it_echo_req)["symbol"];
+                double temp = 0.0;
+                double ask_price = 0;
+                std::string proposal_id;
+                unsigned long long spot_time = 0;
+                if(it_error == j.end()) {
+                        auto it_proposal = j.find("proposal");
+                        double payout = 0;
+                        get_number((*it_proposal)["ask_price"], ask_price);
+                        get_number((*it_proposal)["payout"], payout);
+                        temp = ask_price != 0 ? (payout/ask_price) - 1 : 0.0;
+                        auto it_id = it_proposal->find("id");
+                        if(it_id != it_proposal->end() && it_id->is_string()) proposal_id = *it_id;
+                        auto it_spot_time = it_proposal->find("spot_time");
+                        if(it_spot_time != it_proposal->end()) get_number(*it_spot_time, spot_time);
+                } else {
+                        if((*it_error)["code"] == "AlreadySubscribed") {
+                                return;
+                        }
+                        // повторим подписку на выплаты через очередь постепенной подписки,
+                        // чтобы повтор учитывался в лимите подписок (после RateLimit лимит уже уменьшен)
+                        schedule_proposals(std::vector<std::string>(1, j["echo_req"].dump()));
                 }
+                std::string contract_type = (*it_echo_req)["contract_type"];
+                // принятая сервером подписка увеличивает лимит подписок
+                if(process_proposal(_symbol, contract_type, temp, proposal_id, ask_price, spot_time))
+                        adapt_send_rate(false, true);
         }
 //------------------------------------------------------------------------------
         void parse_json(std::string &str)
         {
                 try {
+                        // тип сообщения определяем один раз, до разбора сообщения
+                        int type = MSG_UNKNOWN;
+                        const char *msg_type = NULL;
+                        size_t msg_type_size = 0;
+                        if(find_msg_type(str, msg_type, msg_type_size)) {
+                                msg_type_.assign(msg_type, msg_type_size);
+                                type = get_message_type(msg_type_);
+                        } else {
+                                msg_type_.clear();
+                        }
+                        // часто приходящие сообщения обрабатываем без построения json
+                        if(parse_fast_json(str, type)) {
+                                if(request_send_times_size_ != 0) add_response_latency(str, false);
+                                return;
+                        }
                         json j = json::parse(str);
-                        /* для ускорения заранее находим сообщения
-                         * msg_type и error
+                        /* для ускорения заранее находим сообщение error
                          */
-                        json::iterator it_msg_type = j.find("msg_type");
                         json::iterator it_error = j.find("error");
+                        if(request_send_times_size_ != 0) add_response_latency(str, it_error != j.end());
                         if(it_error != j.end()) {
                                 try {
                                         write_log_file(j.dump());
@@ -589,22 +3331,17 @@ private:
                                 catch (...) {
                                         write_log_file("check_time_message->j.dump()");
                                 }
+                                auto it_code = it_error->find("code");
+                                if(it_code != it_error->end() && *it_code == "RateLimit")
+                                        adapt_send_rate(true, type == MSG_PROPOSAL);
                         }
                         // обрабатываем сообщение
-                        if(check_ohlc_message(j, it_msg_type, it_error))
-                                return;
-                        if(check_tick_message(j, it_msg_type, it_error))
-                                return;
-                        if(check_proposal_message(j, it_msg_type, it_error))
-                                return;
-                        if(check_candles_message(j, it_msg_type, it_error))
-                                return;
-                        if(check_history_message(j, it_msg_type, it_error))
-                                return;
-                        if(check_time_message(j, it_msg_type, it_error))
-                                return;
-                        if(check_authorize_message(j, it_msg_type, it_error))
-                                return;
+                        call_user_handler(type, j);
+                        if(type < MSG_TYPES_NUM && message_handlers_[type] != NULL) {
+                                (this->*message_handlers_[type])(j, it_error);
+                        } else {
+                                complete_request(j);
+                        }
                 }
                 catch(...) {
                         std::cout << "BinaryApi: on_message error! Message: " <<
@@ -613,33 +3350,70 @@ private:
                 }
         }
 
-public:
 //------------------------------------------------------------------------------
         /** \brief Инициализировать класс
-         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
-         * \param app_id ID API вашего приложения
+         * \param io_service Общий цикл событий или nullptr, если объект использует свои потоки
+         * \param token Токен
+         * \param app_id ID API приложения
          */
-        BinaryAPI(std::string token = "", std::string app_id = "1089")
+        BinaryAPI(std::shared_ptr<BinaryApiEventLoop::IoService> io_service,
+                  const ConnectMode mode,
+                  std::string token,
+                  std::string app_id)
                 : client_("ws.binaryws.com/websockets/v3?l=en&app_id=" +
                         app_id, false) ,
                         is_open_connection_(false),
                         token_(token),
                         is_error_token_(false),
+                        send_limiter_(BINARY_API_MAX_REQUESTS_PER_MINUTE,
+                                      BINARY_API_MIN_REQUESTS_PER_MINUTE,
+                                      BINARY_API_MAX_REQUESTS_PER_MINUTE),
+                        proposal_limiter_(BINARY_API_PROPOSAL_REQUESTS_PER_MINUTE,
+                                          BINARY_API_MIN_REQUESTS_PER_MINUTE,
+                                          BINARY_API_MAX_REQUESTS_PER_MINUTE),
+                        send_budgets_(SEND_PRIORITIES_NUM, TokenBucket(BINARY_API_MAX_REQUESTS_PER_MINUTE,
+                                      (double)BINARY_API_MAX_REQUESTS_PER_MINUTE / 60.0)),
+                        is_shutdown_(false),
+                        last_send_(std::chrono::steady_clock::now()),
+                        request_send_times_size_(0),
+                        latency_dump_period_(0),
+                        io_service_(io_service),
+                        is_send_posted_(false),
+                        is_restart_(false),
+                        alive_(std::make_shared<char>(0)),
+                        alive_weak_(alive_),
                         balance_(0),
                         is_authorize_(false),
+                        ready_waiters_size_(0),
+                        payouts_capacity_(BINARY_API_PAYOUT_HISTORY_CAPACITY),
+                        quotes_capacity_(BINARY_API_STREAM_QUOTATIONS_CAPACITY),
                         is_stream_quotations_(false),
                         is_stream_quotations_error_(false),
                         is_stream_proposal_(false),
+                        is_resume_mode_(false),
                         last_time_(0),
                         is_last_time_(false),
-                        is_array_candles_(false),
-                        is_array_candles_error_(false),
-                        is_send_array_candles_(false),
-                        is_array_ticks_(false),
-                        is_array_ticks_error_(false),
-                        is_send_array_ticks_(false),
+                        last_req_id_(0),
                         is_use_log(false)
         {
+                for(int i = 0; i < MSG_TYPES_NUM; ++i) {
+                        message_handlers_[i] = NULL;
+                        is_user_handler_[i] = false;
+                }
+                reset_dispatch_latency();
+                message_count_ = 0;
+                budget_id_ = get_process_budget().add_client();
+                send_budgets_[SEND_HISTORY] = TokenBucket(BINARY_API_MAX_HISTORY_REQUESTS_PER_MINUTE,
+                        (double)BINARY_API_MAX_HISTORY_REQUESTS_PER_MINUTE / 60.0);
+                message_handlers_[MSG_TICK] = &BinaryAPI::check_tick_message;
+                message_handlers_[MSG_OHLC] = &BinaryAPI::check_ohlc_message;
+                message_handlers_[MSG_PROPOSAL] = &BinaryAPI::check_proposal_message;
+                message_handlers_[MSG_CANDLES] = &BinaryAPI::check_candles_message;
+                message_handlers_[MSG_HISTORY] = &BinaryAPI::check_history_message;
+                message_handlers_[MSG_TIME] = &BinaryAPI::check_time_message;
+                message_handlers_[MSG_AUTHORIZE] = &BinaryAPI::check_authorize_message;
+                user_handlers_.resize(MSG_TYPES_NUM);
+
                 client_.on_open =
                         [&](std::shared_ptr<WssClient::Connection> connection)
                 {
@@ -664,15 +3438,22 @@ public:
                         connection->send(message);
                         connection_mutex_.unlock();
                         is_open_connection_ = true;
+                        resume_streams();
+                        notify_send_thread();
+                        notify_ready();
+                        check_server_clock_sync();
                 };
 
                 client_.on_message =
                         [&](std::shared_ptr<WssClient::Connection> connection,
                                 std::shared_ptr<WssClient::InMessage> message)
                 {
+                        receive_time_ = std::chrono::steady_clock::now();
+                        message_count_.fetch_add(1, std::memory_order_relaxed);
                         std::string text = message->string();
                         //std::cout << "message: " << text << std::endl;
                         parse_json(text);
+                        dump_latency_stats();
                 };
 
                 client_.on_close = [&](std::shared_ptr<WssClient::Connection> /*connection*/,
@@ -684,6 +3465,11 @@ public:
                         std::cout << "BinaryApi: Closed connection with status code " <<
                                 status << std::endl;
                         write_log_file("BinaryApi: Closed connection with status code " + std::to_string(status));
+                        notify_send_thread();
+                        call_disconnect_handler();
+                        if(io_service_) post_to_event_loop([&]() {
+                                restart_client();
+                        });
                 };
 
                 client_.on_error = [&](std::shared_ptr<WssClient::Connection> /*connection*/,
@@ -694,138 +3480,660 @@ public:
                         std::cout << "BinaryApi: Error: " <<
                                 ec << ", error message: " << ec.message() << std::endl;
                         write_log_file("BinaryApi: Error, error message: " + ec.message());
+                        notify_send_thread();
+                        call_disconnect_handler();
+                        if(io_service_) post_to_event_loop([&]() {
+                                restart_client();
+                        });
                 };
 
-                std::thread client_thread([&]() {
-                        while(true) {
-                                std::cout << "BinaryApi: start" << std::endl;
-                                try {
-                                    client_.start();
-                                }
-                                catch(std::exception e) {
-                                    write_log_file("BinaryApi: Error, error message: " + std::string(e.what()));
-                                }
-                                catch(...) {
-                                    write_log_file("BinaryApi: Error, error");
-                                }
-                                std::cout << "BinaryApi: restart" << std::endl;
-                                is_stream_quotations_ = false;
-                                is_stream_proposal_ = false;
-                                is_open_connection_ = false;
-                                is_authorize_ = false;
-                                is_last_time_ = false;
-                                std::this_thread::sleep_for(std::chrono::seconds(5));
-                        }
-                });
-
-                std::thread send_thread([&]() {
-                        //std::chrono::duration<double> start;
-                        std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
-                        std::chrono::time_point<std::chrono::steady_clock> stop = std::chrono::steady_clock::now();
-                        std::chrono::time_point<std::chrono::steady_clock> start_min = std::chrono::steady_clock::now();
-                        std::chrono::time_point<std::chrono::steady_clock> stop_min = std::chrono::steady_clock::now();
-                        const float SECONDS_MINUTE = 60.0f;
-                        const int max_num_requestes = 180; // максимальное число запросов в минуту
-                        int num_requestes = 0; // число запросов в минуту
-                        while(true) {
-                                if(is_open_connection_) {
-                                        // отправим сообщение, если есть что отправлять
-                                        send_queue_mutex_.lock();
-                                        if(send_queue_.size() > 0) {
-                                                std::string message = send_queue_.front();
-                                                send_queue_.pop();
-                                                send_queue_mutex_.unlock();
-                                                //std::cout << "BinaryApi: send " <<
-                                                //        message << std::endl;
-                                                while(!is_open_connection_) {
-                                                    std::this_thread::yield();
-                                                }
-                                                connection_mutex_.lock();
-                                                save_connection_->send(message);
-                                                connection_mutex_.unlock();
-                                                /* проверим ограничение запросов в минуту
-                                                 */
-                                                num_requestes++; // увеличим число запросов в минуту
-                                                stop_min = std::chrono::steady_clock::now();
-                                                //std::chrono::duration<double> diff;
-                                                auto diff = std::chrono::duration_cast<std::chrono::seconds>(stop_min - start_min);
-                                                // проверим количество запросов в минуту
-                                                if(diff.count() < SECONDS_MINUTE) {
-                                                        // запросов стало слишком много?
-                                                        if(num_requestes >= max_num_requestes) {
-                                                                // подождем, пока не пройдет минута
-                                                                while(true) {
-                                                                        stop_min = std::chrono::steady_clock::now();
-                                                                        std::chrono::duration<double> diff;
-                                                                        diff = std::chrono::duration_cast<std::chrono::seconds>(stop_min - start_min);
-                                                                        if(diff.count() >= SECONDS_MINUTE) {
-                                                                                // минута прошла, уходим
-                                                                                start_min = std::chrono::steady_clock::now();
-                                                                                stop_min = std::chrono::steady_clock::now();
-                                                                                num_requestes = 0;
-                                                                                break;
-                                                                        }
-                                                                        std::this_thread::yield();
-                                                                } // while
-                                                        } // if
-                                                } else {
-                                                        start_min = std::chrono::steady_clock::now();
-                                                        stop_min = std::chrono::steady_clock::now();
-                                                        num_requestes = 0;
-                                                }
-                                                /*
-                                                 */
-                                                start = std::chrono::steady_clock::now();
-                                        } else {
-                                                send_queue_mutex_.unlock();
-                                                stop = std::chrono::steady_clock::now();
-                                                auto diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                                                const float PING_DELAY = 20.0f;
-                                                if(diff.count() > PING_DELAY) {
-                                                        json j;
-                                                        j["ping"] = 1;
-                                                        std::string message = j.dump();
-                                                        send_queue_mutex_.lock();
-                                                        send_queue_.push(message);
-                                                        send_queue_mutex_.unlock();
-                                                        start = std::chrono::steady_clock::now();
-                                                }
+                if(io_service_) {
+                        // соединение и очередь сообщений обслуживает общий цикл событий
+                        client_.io_service = io_service_;
+                        send_timer_.reset(new binary_api_asio::steady_timer(*io_service_));
+                        restart_timer_.reset(new binary_api_asio::steady_timer(*io_service_));
+                        post_to_event_loop([&]() {
+                                start_client();
+                        });
+                } else {
+                        std::thread client_thread([&]() {
+                                while(true) {
+                                        std::cout << "BinaryApi: start" << std::endl;
+                                        try {
+                                            client_.start();
                                         }
-                                } else {
-                                        start = std::chrono::steady_clock::now();
+                                        catch(std::exception e) {
+                                            write_log_file("BinaryApi: Error, error message: " + std::string(e.what()));
+                                        }
+                                        catch(...) {
+                                            write_log_file("BinaryApi: Error, error");
+                                        }
+                                        std::cout << "BinaryApi: restart" << std::endl;
+                                        reset_connection_state();
+                                        std::this_thread::sleep_for(std::chrono::seconds(5));
                                 }
-                                std::this_thread::yield();
-                        }
-                });
+                        });
 
-                client_thread.detach();
-                send_thread.detach();
+                        send_thread_ = std::thread([&]() {
+                                send_thread_loop();
+                        });
 
-                while(true) {
-                        token_mutex_.lock();
-                        if(token_ != "") {
-                                token_mutex_.unlock();
-                                if(is_error_token_) {
-                                        break;
-                                }
-                                if(is_authorize_) {
-                                        break;
-                                }
-                        } else {
-                                token_mutex_.unlock();
-                                if(is_open_connection_) {
-                                        break;
+                        client_thread.detach();
+                }
+
+                if(mode == WAIT_CONNECTION) wait_ready(0);
+        }
+//------------------------------------------------------------------------------
+public:
+        /** \brief Инициализировать класс
+         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
+         * \param app_id ID API вашего приложения
+         */
+        BinaryAPI(std::string token = "", std::string app_id = "1089")
+                : BinaryAPI(std::shared_ptr<BinaryApiEventLoop::IoService>(), WAIT_CONNECTION, token, app_id) {};
+//------------------------------------------------------------------------------
+        /** \brief Инициализировать класс
+         * В режиме ASYNC_CONNECTION конструктор не ждет соединения, поэтому несколько
+         * объектов могут подключаться и проходить авторизацию одновременно
+         * \param mode Режим создания объекта (см. ConnectMode)
+         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
+         * \param app_id ID API вашего приложения
+         */
+        BinaryAPI(const ConnectMode mode, std::string token = "", std::string app_id = "1089")
+                : BinaryAPI(std::shared_ptr<BinaryApiEventLoop::IoService>(), mode, token, app_id) {};
+//------------------------------------------------------------------------------
+        /** \brief Инициализировать класс в общем цикле событий
+         * Объект не создает своих потоков: соединение, очередь сообщений и
+         * ограничение числа запросов обслуживаются потоками event_loop
+         * \param event_loop Общий цикл событий
+         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
+         * \param app_id ID API вашего приложения
+         */
+        BinaryAPI(BinaryApiEventLoop &event_loop, std::string token = "", std::string app_id = "1089")
+                : BinaryAPI(event_loop.get_io_service(), WAIT_CONNECTION, token, app_id) {};
+//------------------------------------------------------------------------------
+        /** \brief Инициализировать класс в общем цикле событий
+         * \param event_loop Общий цикл событий
+         * \param mode Режим создания объекта (см. ConnectMode)
+         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
+         * \param app_id ID API вашего приложения
+         */
+        BinaryAPI(BinaryApiEventLoop &event_loop, const ConnectMode mode, std::string token = "", std::string app_id = "1089")
+                : BinaryAPI(event_loop.get_io_service(), mode, token, app_id) {};
+//------------------------------------------------------------------------------
+        ~BinaryAPI()
+        {
+                is_shutdown_ = true;
+                notify_send_thread();
+                if(send_thread_.joinable()) send_thread_.join();
+                if(io_service_) {
+                        // дождемся завершения обработчиков цикла событий, которые уже начали работу
+                        alive_.reset();
+                        while(!alive_weak_.expired()) std::this_thread::yield();
+                }
+                if(is_open_connection_) {
+                        client_.stop();
+                }
+                get_process_budget().remove_client(budget_id_);
+                // объект удаляется, дальше ждать нечего
+                std::vector<ReadyWaiter> waiters;
+                ready_mutex_.lock();
+                waiters.swap(ready_waiters_);
+                ready_cond_.notify_all();
+                ready_mutex_.unlock();
+                for(size_t i = 0; i < waiters.size(); ++i) {
+                        complete_ready_waiter(waiters[i], NO_OPEN_CONNECTION);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Установить обработчик разрыва соединения
+         * Можно вызывать в любой момент. После возврата из функции старый обработчик
+         * уже не вызывается. Обработчик не должен вызывать set_disconnect_handler
+         * \param callback Обработчик (см. on_disconnect) или nullptr
+         */
+        void set_disconnect_handler(std::function<void()> callback)
+        {
+                std::lock_guard<std::mutex> lock(disconnect_mutex_);
+                on_disconnect = std::move(callback);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Дождаться соединения и авторизации
+         * \param timeout_ms Время ожидания в миллисекундах (0 - ждать без ограничения)
+         * \return состояние ошибки (0 в случае успеха, NO_AUTHORIZATION при неверном токене
+         * или если авторизация не пройдена за время ожидания, NO_OPEN_CONNECTION, если нет соединения)
+         */
+        int wait_ready(const long long timeout_ms = 0)
+        {
+                int state = OK;
+                std::unique_lock<std::mutex> lock(ready_mutex_);
+                auto is_done = [&]{
+                        return check_ready(state) || is_shutdown_;
+                };
+                if(timeout_ms > 0) ready_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), is_done);
+                else ready_cond_.wait(lock, is_done);
+                return state;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Дождаться соединения и авторизации без блокировки
+         * \param timeout_ms Время ожидания в миллисекундах (0 - ждать без ограничения)
+         * \return состояние ошибки, которое вернет wait_ready (см. ErrorType)
+         */
+        std::future<int> wait_ready_async(const long long timeout_ms = 0)
+        {
+                ReadyWaiter waiter;
+                waiter.promise = std::make_shared<std::promise<int>>();
+                std::future<int> ready = waiter.promise->get_future();
+                add_ready_waiter(std::move(waiter), timeout_ms);
+                return ready;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Вызвать функцию, когда объект будет готов или истечет время ожидания
+         * Функция вызывается из потока соединения или потока отправки сообщений,
+         * либо сразу, если объект уже готов
+         * \param callback Функция, получает состояние ошибки (см. wait_ready)
+         * \param timeout_ms Время ожидания в миллисекундах (0 - ждать без ограничения)
+         */
+        void async_wait_ready(std::function<void(const int)> callback, const long long timeout_ms = 0)
+        {
+                ReadyWaiter waiter;
+                waiter.callback = callback;
+                add_ready_waiter(std::move(waiter), timeout_ms);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Преобразовать текст в число без создания временных строк
+         * Числа вида 1.23456 с мантиссой до 2^53 преобразуются точно без вызова strtod,
+         * остальные числа преобразуются через strtod из буфера на стеке
+         * \param begin Начало текста
+         * \param end Конец текста
+         * \param value Число
+         * \return вернет true, если весь текст является числом
+         */
+        static bool parse_number(const char *begin, const char *end, double &value)
+        {
+                static const double POW10[] = {
+                        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+                const unsigned long long MAX_MANTISSA = 1ULL << 53;
+                const char *ptr = begin;
+                bool is_negative = false;
+                if(ptr != end && (*ptr == '-' || *ptr == '+')) {
+                        is_negative = *ptr == '-';
+                        ++ptr;
+                }
+                unsigned long long mantissa = 0;
+                int exponent = 0;
+                int num_digits = 0;
+                bool is_exact = true;
+                for(; ptr != end && *ptr >= '0' && *ptr <= '9'; ++ptr, ++num_digits) {
+                        if(mantissa < MAX_MANTISSA / 10) mantissa = mantissa * 10 + (*ptr - '0');
+                        else is_exact = false;
+                }
+                if(ptr != end && *ptr == '.') {
+                        for(++ptr; ptr != end && *ptr >= '0' && *ptr <= '9'; ++ptr, ++num_digits) {
+                                if(mantissa < MAX_MANTISSA / 10) {
+                                        mantissa = mantissa * 10 + (*ptr - '0');
+                                        --exponent;
+                                } else {
+                                        is_exact = false;
                                 }
                         }
-                        std::this_thread::yield();
                 }
+                if(num_digits == 0)
+                        return false;
+                if(ptr != end || !is_exact || exponent < -22) {
+                        // редкий случай: экспонента или слишком длинная мантисса
+                        char buffer[64];
+                        const size_t size = end - begin;
+                        if(size >= sizeof(buffer))
+                                return false;
+                        std::memcpy(buffer, begin, size);
+                        buffer[size] = '\0';
+                        char *buffer_end = NULL;
+                        value = std::strtod(buffer, &buffer_end);
+                        return buffer_end == buffer + size;
+                }
+                value = (double)mantissa;
+                if(exponent < 0) value /= POW10[-exponent];
+                if(is_negative) value = -value;
+                return true;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Преобразовать текст в целое число без создания временных строк
+         * \param begin Начало текста
+         * \param end Конец текста
+         * \param value Число
+         * \return вернет true, если весь текст является целым неотрицательным числом, которое помещается в unsigned long long
+         */
+        static bool parse_number(const char *begin, const char *end, unsigned long long &value)
+        {
+                if(begin == end)
+                        return false;
+                unsigned long long temp = 0;
+                for(const char *ptr = begin; ptr != end; ++ptr) {
+                        if(*ptr < '0' || *ptr > '9')
+                                return false;
+                        const unsigned digit = *ptr - '0';
+                        // число не помещается в unsigned long long (как result_out_of_range у from_chars)
+                        if(temp > (ULLONG_MAX - digit) / 10)
+                                return false;
+                        temp = temp * 10 + digit;
+                }
+                value = temp;
+                return true;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить число из json
+         * Сервер присылает числа как числами, так и строками, поэтому обрабатываются оба варианта
+         * \param j Значение json
+         * \param value Число
+         * \return вернет true, если значение является числом
+         */
+        template <class T>
+        static bool get_number(const json &j, T &value)
+        {
+                if(j.is_number()) {
+                        value = j.get<T>();
+                        return true;
+                }
+                if(j.is_string()) {
+                        const std::string &str = j.get_ref<const std::string &>();
+                        return parse_number(str.data(), str.data() + str.size(), value);
+                }
+                return false;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Преобразовать ответ на запрос тиков
+         * \param j Ответ сервера
+         * \param prices Цены тиков
+         * \param times Время тиков
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        static int parse_ticks_history(json &j,
+                                       std::vector<double> &prices,
+                                       std::vector<unsigned long long> &times)
+        {
+                auto it_history = j.find("history");
+                if(j.find("error") != j.end() || it_history == j.end())
+                        return UNKNOWN_ERROR;
+                json &j_prices = (*it_history)["prices"];
+                json &j_times = (*it_history)["times"];
+                prices.resize(j_prices.size());
+                times.resize(j_times.size());
+                if(j_prices.size() != j_times.size())
+                        return UNKNOWN_ERROR;
+                for(size_t i = 0; i < prices.size(); i++) {
+                        if(!get_number(j_prices[i], prices[i]) ||
+                           !get_number(j_times[i], times[i]))
+                                return UNKNOWN_ERROR;
+                }
+                if(times.size() == 0)
+                        return DATA_NOT_AVAILABLE;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Преобразовать ответ на запрос минутных свечей
+         * \param j Ответ сервера
+         * \param close Цены закрытия свечей
+         * \param times Временные метки открытия свечей
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        static int parse_candles_history(json &j,
+                                         std::vector<double> &close,
+                                         std::vector<unsigned long long> &times)
+        {
+                auto it_candles = j.find("candles");
+                if(j.find("error") != j.end() || it_candles == j.end())
+                        return UNKNOWN_ERROR;
+                json &j_candles = *it_candles;
+                close.resize(j_candles.size());
+                times.resize(j_candles.size());
+                for(size_t i = 0; i < j_candles.size(); i++) {
+                        json &_j = j_candles[i];
+                        if(!get_number(_j["close"], close[i]) ||
+                           !get_number(_j["epoch"], times[i]))
+                                return UNKNOWN_ERROR;
+                }
+                if(times.size() == 0)
+                        return DATA_NOT_AVAILABLE;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Преобразовать ответ на запрос минутных свечей
+         * \param j Ответ сервера
+         * \param candles Минутные свечи
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        template <class CANDLE_TYPE>
+        static int parse_candles_history(json &j, std::vector<CANDLE_TYPE> &candles)
+        {
+                auto it_candles = j.find("candles");
+                if(j.find("error") != j.end() || it_candles == j.end())
+                        return UNKNOWN_ERROR;
+                json &j_candles = *it_candles;
+                candles.resize(j_candles.size());
+                for(size_t i = 0; i < j_candles.size(); i++) {
+                        json &_j = j_candles[i];
+                        double open = 0, high = 0, low = 0, close = 0;
+                        unsigned long long timestamp = 0;
+                        if(!get_number(_j["open"], open) ||
+                           !get_number(_j["high"], high) ||
+                           !get_number(_j["low"], low) ||
+                           !get_number(_j["close"], close) ||
+                           !get_number(_j["epoch"], timestamp))
+                                return UNKNOWN_ERROR;
+                        candles[i].open = open;
+                        candles[i].high = high;
+                        candles[i].low = low;
+                        candles[i].close = close;
+                        candles[i].timestamp = timestamp;
+                }
+                if(candles.size() == 0)
+                        return DATA_NOT_AVAILABLE;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Найти значение msg_type в тексте сообщения без его разбора
+         * \param str Сообщение
+         * \param msg_type Указатель на начало значения msg_type
+         * \param msg_type_size Длина значения msg_type
+         * \return вернет true, если msg_type найден
+         */
+        static bool find_msg_type(const std::string &str,
+                                  const char *&msg_type,
+                                  size_t &msg_type_size)
+        {
+                static const std::string key = "\"msg_type\"";
+                std::string::size_type pos = str.find(key);
+                if(pos == std::string::npos)
+                        return false;
+                pos = str.find('"', pos + key.size());
+                if(pos == std::string::npos)
+                        return false;
+                const std::string::size_type end = str.find('"', pos + 1);
+                if(end == std::string::npos)
+                        return false;
+                msg_type = str.data() + pos + 1;
+                msg_type_size = end - pos - 1;
+                return true;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Найти значение req_id в тексте сообщения без его разбора
+         * \param str Сообщение
+         * \param req_id Значение req_id
+         * \return вернет true, если req_id найден
+         */
+        static bool find_req_id(const std::string &str, long long &req_id)
+        {
+                static const std::string key = "\"req_id\"";
+                std::string::size_type pos = str.find(key);
+                if(pos == std::string::npos)
+                        return false;
+                pos = str.find_first_not_of(" \t\r\n:", pos + key.size());
+                if(pos == std::string::npos || str[pos] < '0' || str[pos] > '9')
+                        return false;
+                req_id = 0;
+                while(pos < str.size() && str[pos] >= '0' && str[pos] <= '9') {
+                        req_id = req_id * 10 + (str[pos] - '0');
+                        ++pos;
+                }
+                return true;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Разобрать сообщение без построения json
+         * Из сообщения извлекаются msg_type, символ, время, цена, ask_price/payout и error.code
+         * \param str Сообщение
+         * \param msg Данные сообщения
+         * \return вернет true, если сообщение удалось разобрать
+         */
+        static bool parse_fast_message(const std::string &str, FastMessage &msg)
+        {
+                msg.clear();
+                FastMessageParser parser(msg);
+                try {
+                        return json::sax_parse(str, &parser);
+                }
+                catch(...) {
+                        return false;
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Установить обработчик сообщений
+         * Позволяет обрабатывать сообщения, которые класс не обрабатывает сам
+         * (например, buy, proposal_open_contract или balance). Обработчик вызывается
+         * из потока соединения до встроенного обработчика сообщения
+         * \param msg_type Тип сообщения (значение поля msg_type)
+         * \param handler Обработчик сообщения. Пустой обработчик удаляет ранее установленный
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int set_message_handler(const std::string &msg_type,
+                                std::function<void(json &)> handler)
+        {
+                if(msg_type == "")
+                        return INVALID_PARAMETER;
+                int type = get_message_type(msg_type);
+                std::lock_guard<std::mutex> lock(user_handlers_mutex_);
+                if(type == MSG_UNKNOWN) {
+                        // новый тип сообщения получает следующий свободный номер
+                        type = user_handlers_.size();
+                        user_message_types_[msg_type] = type;
+                        user_handlers_.resize(type + 1);
+                }
+                const bool is_handler = (bool)handler;
+                user_handlers_[type] = std::move(handler);
+                if(type < MSG_TYPES_NUM) is_user_handler_[type] = is_handler;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить количество строк лога, отброшенных из-за переполнения очереди записи
+         * Очередь записи логов общая для всех объектов BinaryAPI
+         * \return количество отброшенных строк
+         */
+        static unsigned long long get_log_dropped()
+        {
+                return get_logger().get_dropped();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Включить или выключить режим восстановления подписок
+         * В режиме восстановления после переподключения к серверу потоки котировок и
+         * процентов выплат, запущенные через init_stream_quotations и init_stream_proposal,
+         * подписываются заново автоматически. Пропущенные минутные бары догружаются
+         * с последнего сохраненного бара и дописываются в поток котировок
+         * \param is_resume Если true, подписки восстанавливаются
+         */
+        inline void set_resume_mode(const bool is_resume)
+        {
+                is_resume_mode_ = is_resume;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Состояние соединения с сервером
+         * \return вернет true, если соединение открыто
+         */
+        inline bool is_connection()
+        {
+                return is_open_connection_;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить количество сообщений, полученных от сервера
+         * \return количество сообщений с момента создания объекта
+         */
+        inline unsigned long long get_message_count()
+        {
+                return message_count_;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить размер очереди сообщений, ожидающих отправки
+         * \return количество сообщений в очереди
+         */
+        size_t get_send_queue_size()
+        {
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                return get_send_queue_size_locked();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить размер очереди сообщений одного приоритета
+         * \param priority Приоритет отправки (см. SendPriority)
+         * \return количество сообщений в очереди
+         */
+        size_t get_send_queue_size(const int priority)
+        {
+                if(priority < 0 || priority >= SEND_PRIORITIES_NUM)
+                        return 0;
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                return send_queues_[priority].size();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Задать долю лимита запросов для сообщений одного приоритета
+         * Сообщения любого приоритета также ограничены общим лимитом
+         * (см. get_allowed_rate). По умолчанию загрузке истории отдается
+         * BINARY_API_MAX_HISTORY_REQUESTS_PER_MINUTE запросов в минуту, чтобы оставить место
+         * сделкам и подпискам, остальным приоритетам - весь лимит
+         * \param priority Приоритет отправки (см. SendPriority)
+         * \param requests_per_minute Количество запросов в минуту
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int set_send_budget(const int priority, const int requests_per_minute)
+        {
+                if(priority < 0 || priority >= SEND_PRIORITIES_NUM || requests_per_minute <= 0)
+                        return INVALID_PARAMETER;
+                send_queue_mutex_.lock();
+                send_budgets_[priority] = TokenBucket(requests_per_minute, (double)requests_per_minute / 60.0);
+                is_send_notified_ = true;
+                send_queue_mutex_.unlock();
+                wake_send_queue();
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить размер очереди отложенных сообщений
+         * Отложенные сообщения - это повторы запросов после ошибок RateLimit, MarketIsClosed и т.д.
+         * \return количество отложенных сообщений
+         */
+        size_t get_delayed_queue_size()
+        {
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                return delayed_queue_.size();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить текущий лимит запросов
+         * Лимит общий для всех запросов. Он уменьшается вдвое после ошибки RateLimit
+         * и растет на один запрос в минуту с каждым быстрым успешным ответом сервера,
+         * но не выше BINARY_API_MAX_REQUESTS_PER_MINUTE
+         * \return количество запросов в минуту
+         */
+        double get_allowed_rate()
+        {
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                return send_limiter_.get_rate();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить текущий лимит подписок на проценты выплат
+         * Начальный лимит BINARY_API_PROPOSAL_REQUESTS_PER_MINUTE уменьшается вдвое после
+         * ошибки RateLimit на подписку и растет с каждой подпиской без ошибок
+         * \return количество подписок в минуту
+         */
+        double get_allowed_proposal_rate()
+        {
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                return proposal_limiter_.get_rate();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Задать общий лимит запросов всех объектов BinaryAPI процесса
+         * Объекты одного процесса работают с одного IP и app_id и делят один лимит сервера.
+         * Лимит подстраивается по ошибкам RateLimit так же, как лимит объекта (см. get_allowed_rate)
+         * \param requests_per_minute Количество запросов в минуту
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        static int set_process_budget(const int requests_per_minute)
+        {
+                if(requests_per_minute <= 0)
+                        return INVALID_PARAMETER;
+                get_process_budget().set_rate(requests_per_minute);
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить текущий общий лимит запросов процесса
+         * \return количество запросов в минуту
+         */
+        static double get_process_allowed_rate()
+        {
+                return get_process_budget().get_rate();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить расход общего лимита запросов по объектам BinaryAPI
+         * \param usage Расход лимита каждым объектом процесса
+         */
+        static void get_process_budget_usage(std::vector<BudgetUsage> &usage)
+        {
+                get_process_budget().get_usage(usage);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Задать имя объекта в статистике общего лимита запросов
+         * \param name Имя объекта
+         */
+        void set_budget_name(const std::string &name)
+        {
+                get_process_budget().set_name(budget_id_, name);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить статистику задержки обработчика событий
+         * \param type Тип события (см. DispatchType)
+         * \param latency Статистика задержки от получения сообщения до возврата из обработчика
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_dispatch_latency(const int type, DispatchLatency &latency)
+        {
+                if(type < 0 || type >= DISPATCH_TYPES_NUM)
+                        return INVALID_PARAMETER;
+                latency.count = dispatch_count_[type].load(std::memory_order_relaxed);
+                const unsigned long long sum = dispatch_sum_[type].load(std::memory_order_relaxed);
+                latency.mean = latency.count > 0 ? (double)sum / (double)latency.count / 1000.0 : 0.0;
+                latency.max = (double)dispatch_max_[type].load(std::memory_order_relaxed) / 1000.0;
+                latency.last = (double)dispatch_last_[type].load(std::memory_order_relaxed) / 1000.0;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /// Сбросить статистику задержки обработчиков событий
+        void reset_dispatch_latency()
+        {
+                for(int i = 0; i < DISPATCH_TYPES_NUM; ++i) {
+                        dispatch_count_[i] = 0;
+                        dispatch_sum_[i] = 0;
+                        dispatch_max_[i] = 0;
+                        dispatch_last_[i] = 0;
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить статистику задержек запросов
+         * \param stats Гистограммы задержек ответа по типам сообщений (msg_type),
+         * времени ожидания в очереди отправки и простоя из-за ограничения числа запросов
+         */
+        void get_latency_stats(LatencyStats &stats)
+        {
+                std::lock_guard<std::mutex> lock(latency_mutex_);
+                stats = latency_stats_;
         }
- //------------------------------------------------------------------------------
-        ~BinaryAPI()
+//------------------------------------------------------------------------------
+        /// Сбросить статистику задержек запросов
+        void reset_latency_stats()
         {
-                if(is_open_connection_) {
-                        client_.stop();
-                }
+                std::lock_guard<std::mutex> lock(latency_mutex_);
+                latency_stats_.round_trip.clear();
+                latency_stats_.queue_wait.clear();
+                latency_stats_.limiter_stall.clear();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Включить периодическую запись статистики задержек в файл
+         * Статистика дописывается в файл фоновым потоком записи логов.
+         * Время записи проверяется при получении сообщений, поэтому при отсутствии
+         * потоков котировок записи идут не реже, чем приходят ответы на ping
+         * \param file_name Имя файла
+         * \param period Период записи (секунды). Если 0, запись отключена
+         */
+        void set_latency_dump(const std::string &file_name, const int period)
+        {
+                latency_mutex_.lock();
+                latency_file_name_ = file_name;
+                latency_mutex_.unlock();
+                latency_dump_period_ = period;
         }
 //------------------------------------------------------------------------------
         /** \brief Запустить или остановить запись логов
@@ -885,45 +4193,141 @@ public:
                 j["forget_all"] = "balance";
                 return send_json_with_authorize(j);
         }
+//------------------------------------------------------------------------------
+        /** \brief Отправить запрос с обработчиком ответа
+         * Запросу присваивается уникальный req_id, по которому ответ сервера
+         * будет передан обработчику. Обработчик вызывается из потока соединения
+         * и может забрать (переместить) полученное сообщение
+         * \param j Запрос
+         * \param callback Обработчик ответа
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int send_request(json &j, std::function<void(json &)> callback)
+        {
+                if(!is_open_connection_)
+                        return NO_OPEN_CONNECTION;
+                const long long req_id = ++last_req_id_;
+                j["req_id"] = req_id;
+                pending_requests_mutex_.lock();
+                pending_requests_[req_id] = std::move(callback);
+                pending_requests_mutex_.unlock();
+                send_message(j.dump(), req_id, get_send_priority(j));
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Отправить запрос и получить ответ через std::future
+         * \param j Запрос
+         * \param response Ответ сервера
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int send_request(json &j, std::future<json> &response)
+        {
+                std::shared_ptr<std::promise<json>> promise = std::make_shared<std::promise<json>>();
+                response = promise->get_future();
+                return send_request(j, [promise](json &j) {
+                        promise->set_value(std::move(j));
+                });
+        }
+//------------------------------------------------------------------------------
+        /** \brief Отправить запрос исторических данных
+         * \param response Ответ сервера
+         * \param req_id ID отправленного запроса
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int download_history(std::string &symbol,
+                             unsigned long long startepoch,
+                             unsigned long long endepoch,
+                             int count,
+                             bool is_candles,
+                             std::future<json> &response,
+                             long long &req_id)
+        {
+                json j;
+                int err_data = make_history_request(j, symbol, startepoch, endepoch, count, is_candles);
+                if(err_data != OK)
+                        return err_data;
+                err_data = send_request(j, response);
+                if(err_data == OK) req_id = j["req_id"];
+                return err_data;
+        }
 //------------------------------------------------------------------------------
         /** \brief Загрузить исторические данные тиков
+         * Одновременно может выполняться любое количество таких запросов
          * \param symbol Имя валютной пары
          * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
          * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param response Ответ сервера, передается в get_ticks
+         * \param req_id ID запроса, передается в get_ticks, чтобы забыть запрос, если ответ не придет
          * \param count_ticks Количество тиков. Не имеет смысла ставить данный параметр больше 5000
          * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
          */
         int download_ticks(std::string symbol,
                            unsigned long long startepoch,
                            unsigned long long endepoch,
+                           std::future<json> &response,
+                           long long &req_id,
                            int count_ticks = 5000)
         {
-                if(startepoch > 0 && endepoch > startepoch) {
-                        unsigned long long diff = endepoch - startepoch;
-                        if((symbol.find("R_") == std::string::npos && diff > 5000)
-                                || (symbol.find("R_") != std::string::npos && diff > 10000))
-                                return INVALID_PARAMETER;
-                }
-                if(count_ticks > 5000)
-                        return INVALID_PARAMETER;
-                json j;
-                j["ticks_history"] = symbol;
-                if(endepoch == 0) j["end"] = "latest";
-                else j["end"] = endepoch;
-                if(startepoch == 0) {
-                        j["start"] = 1;
-                        j["count"] = count_ticks;
-                } else {
-                        j["start"] = startepoch;
-                }
-                j["style"] = "ticks";
+                return download_history(symbol, startepoch, endepoch, count_ticks, false, response, req_id);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Загрузить исторические данные тиков
+         * \param symbol Имя валютной пары
+         * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
+         * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param response Ответ сервера, передается в get_ticks
+         * \param count_ticks Количество тиков. Не имеет смысла ставить данный параметр больше 5000
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int download_ticks(std::string symbol,
+                           unsigned long long startepoch,
+                           unsigned long long endepoch,
+                           std::future<json> &response,
+                           int count_ticks = 5000)
+        {
+                long long req_id = 0;
+                return download_ticks(symbol, startepoch, endepoch, response, req_id, count_ticks);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Загрузить исторические данные тиков
+         * \param symbol Имя валютной пары
+         * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
+         * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param count_ticks Количество тиков. Не имеет смысла ставить данный параметр больше 5000
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int download_ticks(std::string symbol,
+                           unsigned long long startepoch,
+                           unsigned long long endepoch,
+                           int count_ticks = 5000)
+        {
+                std::future<json> response;
+                long long req_id = 0;
+                int err_data = download_ticks(symbol, startepoch, endepoch, response, req_id, count_ticks);
                 array_ticks_mutex_.lock();
-                array_ticks_.clear();
+                array_ticks_ = std::move(response);
+                array_ticks_req_id_ = req_id;
                 array_ticks_mutex_.unlock();
-                is_array_ticks_error_ = false;
-                is_array_ticks_ = false;
-                is_send_array_ticks_ = true;
-                return send_json(j);
+                return err_data;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить исторические данные тиков
+         * \param response Ответ сервера, полученный от download_ticks
+         * \param prices Цены тиков
+         * \param times Время тиков
+         * \param req_id ID запроса, полученный от download_ticks (если ответ не придет, запрос будет забыт)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_ticks(std::future<json> &response,
+                      std::vector<double> &prices,
+                      std::vector<unsigned long long> &times,
+                      const long long req_id = 0)
+        {
+                json j;
+                int err_data = wait_response(response, j, req_id);
+                if(err_data != OK)
+                        return err_data;
+                return parse_ticks_history(j, prices, times);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить исторические данные тиков
@@ -934,49 +4338,11 @@ public:
         int get_ticks(std::vector<double> &prices,
                       std::vector<unsigned long long> &times)
         {
-                if(!is_send_array_ticks_)
-                        return NO_COMMAND;
-                is_send_array_ticks_ = false;
-                //std::chrono::time_point<std::chrono::steady_clock>
-                auto start = std::chrono::steady_clock::now();
-                auto stop = std::chrono::steady_clock::now();
-                while(true) {
-                        std::this_thread::yield();
-
-                        // получили историю
-                        if(is_array_ticks_) {
-                                break;
-                        }
-
-                        stop = std::chrono::steady_clock::now();
-                        //std::chrono::duration<double>
-                        auto diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                        const float MAX_DELAY = 60.0f;
-                        // слишком долго ждем историю
-                        if(diff.count() > MAX_DELAY) {
-                                return UNKNOWN_ERROR;
-                        }
-                }
-                // если была ошибка получения котировок
-                if(is_array_ticks_error_) {
-                        return UNKNOWN_ERROR;
-                } else {
-                        // преобразуем данные
-                        array_ticks_mutex_.lock();
-                        json j_prices = array_ticks_["prices"];
-                        json j_times = array_ticks_["times"];
-                        prices.resize(j_prices.size());
-                        times.resize(j_times.size());
-                        for(size_t i = 0; i < prices.size(); i++) {
-                                prices[i] = atof((j_prices[i].get<std::string>()).c_str());
-                                times[i] = atoi((j_times[i].get<std::string>()).c_str()); //atoi(timestr.c_str());
-                        }
-                        array_ticks_mutex_.unlock();
-                        if(times.size() == 0) {
-                                return DATA_NOT_AVAILABLE;
-                        }
-                }
-                return OK;
+                array_ticks_mutex_.lock();
+                std::future<json> response = std::move(array_ticks_);
+                const long long req_id = array_ticks_req_id_;
+                array_ticks_mutex_.unlock();
+                return get_ticks(response, prices, times, req_id);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить исторические данные тиков
@@ -995,105 +4361,169 @@ public:
                         unsigned long long endepoch,
                         int count_ticks = 5000)
         {
-                int err_data = download_ticks(symbol, startepoch, endepoch, count_ticks);
+                std::future<json> response;
+                long long req_id = 0;
+                int err_data = download_ticks(symbol, startepoch, endepoch, response, req_id, count_ticks);
                 if(err_data != OK)
                         return err_data;
-                return get_ticks(prices, times);
+                return get_ticks(response, prices, times, req_id);
         }
 //------------------------------------------------------------------------------
-        /** \brief Получить исторические данные тиков
+        /** \brief Получить исторические данные тиков без ограничения по времени
+         * Запросы частей по 5000 секунд выполняются конвейером
          * \param symbol Имя валютной пары
          * \param prices Цены тиков
          * \param times Время тиков
-         * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
-         * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param startepoch Время начала получения тиков
+         * \param endepoch Конечное время получения тиков
+         * \param max_requests Максимальное число одновременно выполняемых запросов
+         * \param chunks_per_second Достигнутая скорость загрузки (частей в секунду)
          * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
          */
         int get_ticks_without_limits(std::string symbol,
                                      std::vector<double> &prices,
                                      std::vector<unsigned long long> &times,
                                      unsigned long long startepoch,
-                                     unsigned long long endepoch)
+                                     unsigned long long endepoch,
+                                     int max_requests,
+                                     double &chunks_per_second)
         {
-                if(startepoch == 0 || endepoch == 0 || endepoch < startepoch)
-                        return INVALID_PARAMETER;
                 unsigned long long offset_time = 1;
                 if(symbol.find("R_") != std::string::npos)
                         offset_time = 2;
-
-                unsigned long long epoch = startepoch;
                 const int COUNT_TICKS_LIMIT = 5000;
-                while(true) {
+                auto download = [&](unsigned long long epoch, unsigned long long _endepoch, std::future<json> &response, long long &req_id) {
+                        return download_history(symbol, epoch, _endepoch, 5000, false, response, req_id);
+                };
+                auto append = [&](json &j, unsigned long long epoch, unsigned long long _endepoch) {
                         std::vector<double> _prices;
                         std::vector<unsigned long long> _times;
-                        unsigned long long _endepoch = epoch + COUNT_TICKS_LIMIT;
-                        if(_endepoch > endepoch) {
-                                _endepoch = endepoch;
-                        }
-                        int err_data = get_ticks(symbol, _prices, _times, epoch, _endepoch);
+                        int err_data = parse_ticks_history(j, _prices, _times);
                         // при возникновении ограничений по получению данных, дата последних доступных данных не меняется
                         // сервер присылает последние доступные данные, поэтому так и можно проверить
                         if(_times.size() > 0 && !(_times[0] >= epoch && _times.back() <= _endepoch))
-                                return DATA_NOT_AVAILABLE;
-
+                                return (int)DATA_NOT_AVAILABLE;
                         if(err_data != OK && err_data != DATA_NOT_AVAILABLE)
                                 return err_data;
-
-                        const auto prices_size = prices.size();
-                        const auto times_size = times.size();
-
-                        prices.reserve(prices_size + _prices.size());
-                        times.reserve(times_size + _times.size());
-                        try {
-                                prices.insert(prices.end(), _prices.begin(), _prices.end());
-                                times.insert(times.end(), _times.begin(), _times.end());
-                        }
-                        catch(...) {
-                                prices.erase(prices.begin() + prices_size, prices.end());
-                                times.erase(times.begin() + times_size, times.end());
-                                return UNKNOWN_ERROR;
-                        }
-
-                        if(_endepoch == endepoch) {
-                                break;
-                        }
-                        // чтобы один и тот же момент времени не встречался дважды
-                        epoch = _endepoch + offset_time;
-                } // while
-                return OK;
+                        return append_history(prices, times, _prices, _times);
+                };
+                return get_history_pipelined(startepoch, endepoch, COUNT_TICKS_LIMIT, offset_time,
+                                             max_requests, chunks_per_second, download, append);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить исторические данные тиков
+         * \param symbol Имя валютной пары
+         * \param prices Цены тиков
+         * \param times Время тиков
+         * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
+         * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_ticks_without_limits(std::string symbol,
+                                     std::vector<double> &prices,
+                                     std::vector<unsigned long long> &times,
+                                     unsigned long long startepoch,
+                                     unsigned long long endepoch)
+        {
+                double chunks_per_second = 0;
+                return get_ticks_without_limits(symbol, prices, times, startepoch, endepoch, 1, chunks_per_second);
         }
 //------------------------------------------------------------------------------
         /** \brief Загрузить исторические данные минутных свечей
+         * Одновременно может выполняться любое количество таких запросов
          * \param symbol Имя валютной пары
          * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
          * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param response Ответ сервера, передается в get_candles
+         * \param req_id ID запроса, передается в get_candles, чтобы забыть запрос, если ответ не придет
          * \param count_candles Количество свечей. Не имеет смысла ставить данный параметр больше 5000
          * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
          */
         int download_candles(std::string symbol,
                              unsigned long long startepoch,
                              unsigned long long endepoch,
+                             std::future<json> &response,
+                             long long &req_id,
                              int count_candles = 5000)
         {
-                json j;
-                j["ticks_history"] = symbol;
-                if(endepoch == 0) j["end"] = "latest";
-                else j["end"] = endepoch;
-                if(startepoch == 0) {
-                        j["start"] = 1;
-                        j["count"] = count_candles;
-                } else {
-                        j["start"] = startepoch;
-                }
-                j["style"] = "candles";
-                j["granularity"] = 60;
+                return download_history(symbol, startepoch, endepoch, count_candles, true, response, req_id);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Загрузить исторические данные минутных свечей
+         * \param symbol Имя валютной пары
+         * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
+         * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param response Ответ сервера, передается в get_candles
+         * \param count_candles Количество свечей. Не имеет смысла ставить данный параметр больше 5000
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int download_candles(std::string symbol,
+                             unsigned long long startepoch,
+                             unsigned long long endepoch,
+                             std::future<json> &response,
+                             int count_candles = 5000)
+        {
+                long long req_id = 0;
+                return download_candles(symbol, startepoch, endepoch, response, req_id, count_candles);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Загрузить исторические данные минутных свечей
+         * \param symbol Имя валютной пары
+         * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
+         * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
+         * \param count_candles Количество свечей. Не имеет смысла ставить данный параметр больше 5000
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int download_candles(std::string symbol,
+                             unsigned long long startepoch,
+                             unsigned long long endepoch,
+                             int count_candles = 5000)
+        {
+                std::future<json> response;
+                long long req_id = 0;
+                int err_data = download_candles(symbol, startepoch, endepoch, response, req_id, count_candles);
                 array_candles_mutex_.lock();
-                array_candles_.clear();
+                array_candles_ = std::move(response);
+                array_candles_req_id_ = req_id;
                 array_candles_mutex_.unlock();
-                is_array_candles_error_ = false;
-                is_array_candles_ = false;
-                is_send_array_candles_ = true;
-                return send_json(j);
+                return err_data;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить исторические данные минутных свечей
+         * \param response Ответ сервера, полученный от download_candles
+         * \param close Цены закрытия свечей
+         * \param times Временные метки открытия свечей
+         * \param req_id ID запроса, полученный от download_candles (если ответ не придет, запрос будет забыт)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_candles(std::future<json> &response,
+                        std::vector<double> &close,
+                        std::vector<unsigned long long> &times,
+                        const long long req_id = 0)
+        {
+                json j;
+                int err_data = wait_response(response, j, req_id);
+                if(err_data != OK)
+                        return err_data;
+                return parse_candles_history(j, close, times);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить исторические данные минутных свечей
+         * \param response Ответ сервера, полученный от download_candles
+         * \param candles данные минутных свечей
+         * \param req_id ID запроса, полученный от download_candles (если ответ не придет, запрос будет забыт)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        template <class CANDLE_TYPE>
+        int get_candles(std::future<json> &response,
+                        std::vector<CANDLE_TYPE> &candles,
+                        const long long req_id = 0)
+        {
+                json j;
+                int err_data = wait_response(response, j, req_id);
+                if(err_data != OK)
+                        return err_data;
+                return parse_candles_history(j, candles);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить исторические данные минутных свечей
@@ -1104,47 +4534,11 @@ public:
         int get_candles(std::vector<double> &close,
                         std::vector<unsigned long long> &times)
         {
-                if(!is_send_array_candles_)
-                        return NO_COMMAND;
-                is_send_array_candles_ = false;
-                //std::chrono::time_point<std::chrono::steady_clock>
-                auto start = std::chrono::steady_clock::now();
-                auto stop = std::chrono::steady_clock::now();
-                while(true) {
-                        std::this_thread::yield();
-
-                        // получили историю
-                        if(is_array_candles_) {
-                                break;
-                        }
-
-                        stop = std::chrono::steady_clock::now();
-                        auto diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                        const float MAX_DELAY = 60.0f;
-                        // слишком долго ждем историю
-                        if(diff.count() > MAX_DELAY) {
-                                return UNKNOWN_ERROR;
-                        }
-                }
-                // если была ошибка получения котировок
-                if(is_array_candles_error_) {
-                        return UNKNOWN_ERROR;
-                } else {
-                        // преобразуем данные
-                        array_candles_mutex_.lock();
-                        close.resize(array_candles_.size());
-                        times.resize(array_candles_.size());
-                        for(size_t i = 0; i < array_candles_.size(); i++) {
-                                json j = array_candles_[i];
-                                close[i] = atof((j["close"].get<std::string>()).c_str());
-                                std::string timestr = j["epoch"].dump();
-                                times[i] = atoi(timestr.c_str());
-                        }
-                        array_candles_mutex_.unlock();
-                        if(times.size() == 0)
-                                return DATA_NOT_AVAILABLE;
-                }
-                return OK;
+                array_candles_mutex_.lock();
+                std::future<json> response = std::move(array_candles_);
+                const long long req_id = array_candles_req_id_;
+                array_candles_mutex_.unlock();
+                return get_candles(response, close, times, req_id);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить исторические данные минутных свечей
@@ -1154,48 +4548,11 @@ public:
         template <class CANDLE_TYPE>
         int get_candles(std::vector<CANDLE_TYPE> &candles)
         {
-                if(!is_send_array_candles_)
-                        return NO_COMMAND;
-                is_send_array_candles_ = false;
-
-                auto start = std::chrono::steady_clock::now();
-                auto stop = std::chrono::steady_clock::now();
-                while(true) {
-                        std::this_thread::yield();
-
-                        // получили историю
-                        if(is_array_candles_) {
-                                break;
-                        }
-
-                        stop = std::chrono::steady_clock::now();
-                        auto diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                        const float MAX_DELAY = 60.0f;
-                        // слишком долго ждем историю
-                        if(diff.count() > MAX_DELAY) {
-                                return UNKNOWN_ERROR;
-                        }
-                }
-                // если была ошибка получения котировок
-                if(is_array_candles_error_) {
-                        return UNKNOWN_ERROR;
-                } else {
-                        // преобразуем данные
-                        array_candles_mutex_.lock();
-                        candles.resize(array_candles_.size());
-                        for(size_t i = 0; i < array_candles_.size(); i++) {
-                                json j = array_candles_[i];
-                                candles[i].open = j["open"];//atof((j["open"].get<std::string>()).c_str());
-                                candles[i].high = j["high"];//atof((j["high"].get<std::string>()).c_str());
-                                candles[i].low = j["low"];//atof((j["low"].get<std::string>()).c_str());
-                                candles[i].close = j["close"];//atof((j["close"].get<std::string>()).c_str());
-                                //std::string timestr = //j["epoch"].dump();
-                                candles[i].timestamp = j["epoch"];//atoi(timestr.c_str());
-                        }
-                        array_candles_mutex_.unlock();
-                        if(candles.size() == 0) return DATA_NOT_AVAILABLE;
-                }
-                return OK;
+                array_candles_mutex_.lock();
+                std::future<json> response = std::move(array_candles_);
+                const long long req_id = array_candles_req_id_;
+                array_candles_mutex_.unlock();
+                return get_candles(response, candles, req_id);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить исторические данные минутных свечей
@@ -1214,16 +4571,17 @@ public:
                         unsigned long long endepoch,
                         int count_candles = 5000)
         {
-                int err_data = download_candles(symbol, startepoch, endepoch, count_candles);
+                std::future<json> response;
+                long long req_id = 0;
+                int err_data = download_candles(symbol, startepoch, endepoch, response, req_id, count_candles);
                 if(err_data != OK)
                         return err_data;
-                return get_candles(close, times);
+                return get_candles(response, close, times, req_id);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить исторические данные минутных свечей
          * \param symbol Имя валютной пары
-         * \param close Цены закрытия свечей
-         * \param times Временные метки открытия свечей
+         * \param candles данные минутных свечей
          * \param startepoch Время начала получения тиков. Влияет, если тиков между startepoch и endepoch не больше 5000
          * \param endepoch Конечное время получения тиков. Если нужно получить последние тики, укажите 0
          * \param count_candles Количество свечей. Не имеет смысла ставить данный параметр больше 5000
@@ -1236,115 +4594,142 @@ public:
                         unsigned long long endepoch,
                         int count_candles = 5000)
         {
-                int err_data = download_candles(symbol, startepoch, endepoch, count_candles);
+                std::future<json> response;
+                long long req_id = 0;
+                int err_data = download_candles(symbol, startepoch, endepoch, response, req_id, count_candles);
                 if(err_data != OK)
                         return err_data;
-                return get_candles(candles);
+                return get_candles(response, candles, req_id);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить исторические данные минутных свечей без ограничения по времени
+         * Запросы частей по 5000 свечей выполняются конвейером
+         * \param symbol Имя валютной пары
+         * \param close Цены закрытия свечей
+         * \param times Временные метки открытия свечей
+         * \param startepoch Начальное время
+         * \param endepoch Конечное время
+         * \param max_requests Максимальное число одновременно выполняемых запросов
+         * \param chunks_per_second Достигнутая скорость загрузки (частей в секунду)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_candles_without_limits(std::string symbol,
+                                       std::vector<double> &close,
+                                       std::vector<unsigned long long> &times,
+                                       unsigned long long startepoch,
+                                       unsigned long long endepoch,
+                                       int max_requests,
+                                       double &chunks_per_second)
+        {
+                const int COUNT_TICKS_LIMIT = xtime::SECONDS_IN_MINUTE*5000;
+                auto download = [&](unsigned long long epoch, unsigned long long _endepoch, std::future<json> &response, long long &req_id) {
+                        return download_history(symbol, epoch, _endepoch, 5000, true, response, req_id);
+                };
+                auto append = [&](json &j, unsigned long long epoch, unsigned long long _endepoch) {
+                        std::vector<double> _close;
+                        std::vector<unsigned long long> _times;
+                        int err_data = parse_candles_history(j, _close, _times);
+                        if(_times.size() > 0 && !(_times[0] >= epoch && _times.back() <= _endepoch))
+                                return (int)DATA_NOT_AVAILABLE;
+                        if(err_data != OK && err_data != DATA_NOT_AVAILABLE)
+                                return err_data;
+                        return append_history(close, times, _close, _times);
+                };
+                return get_history_pipelined(startepoch, endepoch, COUNT_TICKS_LIMIT, xtime::SECONDS_IN_MINUTE,
+                                             max_requests, chunks_per_second, download, append);
         }
 //------------------------------------------------------------------------------
+        /** \brief Получить исторические данные минутных свечей без ограничения по времени
+         * \param symbol Имя валютной пары
+         * \param close Цены закрытия свечей
+         * \param times Временные метки открытия свечей
+         * \param startepoch Начальное время
+         * \param endepoch Конечное время
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
         int get_candles_without_limits(std::string symbol,
                                        std::vector<double> &close,
                                        std::vector<unsigned long long> &times,
                                        unsigned long long startepoch,
                                        unsigned long long endepoch)
         {
-                if(startepoch == 0 || endepoch == 0 || endepoch < startepoch)
-                        return INVALID_PARAMETER;
-
-                unsigned long long epoch = startepoch;
-                const int COUNT_TICKS_LIMIT = 60*5000;
-                //std::cout << "startepoch " << startepoch << " endepoch " << endepoch << std::endl;
-                while(true) {
-                        std::vector<double> _close;
-                        std::vector<unsigned long long> _times;
-                        unsigned long long _endepoch = epoch + COUNT_TICKS_LIMIT;
-                        if(_endepoch > endepoch) {
-                                _endepoch = endepoch;
-                        }
-                        //std::cout << "epoch " << epoch << " _endepoch " << _endepoch << std::endl;
-                        int err_data = get_candles(symbol, _close, _times, epoch, _endepoch);
-                        if(_times.size() > 0 && !(_times[0] >= epoch && _times.back() <= _endepoch))
-                                return DATA_NOT_AVAILABLE;
-
-                        if(err_data != OK && err_data != DATA_NOT_AVAILABLE)
-                                return err_data;
-
-                        const auto close_size = close.size();
-                        const auto times_size = times.size();
-
-                        close.reserve(close_size + _close.size());
-                        times.reserve(times_size + _times.size());
-                        try {
-                                close.insert(close.end(), _close.begin(), _close.end());
-                                times.insert(times.end(), _times.begin(), _times.end());
-                        }
-                        catch(...) {
-                                close.erase(close.begin() + close_size, close.end());
-                                times.erase(times.begin() + times_size, times.end());
-                                return UNKNOWN_ERROR;
-                        }
-
-                        if(_endepoch == endepoch) {
-                                break;
-                        }
-                        // чтобы один и тот же момент времени не встречался дважды
-                        epoch = _endepoch + xtime::SECONDS_IN_MINUTE;
-                } // while
-                return OK;
+                double chunks_per_second = 0;
+                return get_candles_without_limits(symbol, close, times, startepoch, endepoch, 1, chunks_per_second);
         }
 //------------------------------------------------------------------------------
         /** \brief Получить свечи без лимита по времени
+         * Запросы частей по 5000 свечей выполняются конвейером
          * \param symbol имя символа для загрузки исторических данных
          * \param candles массив свечей
          * \param startepoch начальная эпоха
          * \param endepoch конечная эпоха
+         * \param max_requests Максимальное число одновременно выполняемых запросов
+         * \param chunks_per_second Достигнутая скорость загрузки (частей в секунду)
          * \return вернет состояние ошибки
          */
         template <class CANDLE_TYPE>
         int get_candles_without_limits(std::string symbol,
                                        std::vector<CANDLE_TYPE> &candles,
                                        xtime::timestamp_t startepoch,
-                                       xtime::timestamp_t endepoch)
+                                       xtime::timestamp_t endepoch,
+                                       int max_requests,
+                                       double &chunks_per_second)
         {
-                if(startepoch == 0 || endepoch == 0 || endepoch < startepoch)
-                        return INVALID_PARAMETER;
-
-                xtime::timestamp_t epoch = startepoch;
                 const int COUNT_TICKS_LIMIT = xtime::SECONDS_IN_MINUTE*5000;
-                //std::cout << "startepoch " << startepoch << " endepoch " << endepoch << std::endl;
-                while(true) {
+                auto download = [&](unsigned long long epoch, unsigned long long _endepoch, std::future<json> &response, long long &req_id) {
+                        return download_history(symbol, epoch, _endepoch, 5000, true, response, req_id);
+                };
+                auto append = [&](json &j, unsigned long long epoch, unsigned long long _endepoch) {
                         std::vector<CANDLE_TYPE> _candles;
-                        xtime::timestamp_t _endepoch = epoch + COUNT_TICKS_LIMIT;
-                        if(_endepoch > endepoch) {
-                                _endepoch = endepoch;
-                        }
-                        int err_data = get_candles(symbol, _candles, epoch, _endepoch);
+                        int err_data = parse_candles_history(j, _candles);
                         if(_candles.size() > 0 &&
                             !(_candles[0].timestamp >= epoch &&
                              _candles.back().timestamp <= _endepoch)) {
-                             return DATA_NOT_AVAILABLE;
+                             return (int)DATA_NOT_AVAILABLE;
                         }
-
                         if(err_data != OK && err_data != DATA_NOT_AVAILABLE)
                                 return err_data;
-
-                        const auto candles_size = candles.size();
-                        candles.reserve(candles_size + _candles.size());
-                        try {
-                                candles.insert(candles.end(), _candles.begin(), _candles.end());
-                        }
-                        catch(...) {
-                                candles.erase(candles.begin() + candles_size, candles.end());
-                                return UNKNOWN_ERROR;
-                        }
-
-                        if(_endepoch == endepoch) {
-                                break;
-                        }
-                        // чтобы один и тот же момент времени не встречался дважды
-                        epoch = _endepoch + xtime::SECONDS_IN_MINUTE;
-                } // while
-                return OK;
+                        return append_history(candles, _candles);
+                };
+                return get_history_pipelined(startepoch, endepoch, COUNT_TICKS_LIMIT, xtime::SECONDS_IN_MINUTE,
+                                             max_requests, chunks_per_second, download, append);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить свечи без лимита по времени
+         * \param symbol имя символа для загрузки исторических данных
+         * \param candles массив свечей
+         * \param startepoch начальная эпоха
+         * \param endepoch конечная эпоха
+         * \return вернет состояние ошибки
+         */
+        template <class CANDLE_TYPE>
+        int get_candles_without_limits(std::string symbol,
+                                       std::vector<CANDLE_TYPE> &candles,
+                                       xtime::timestamp_t startepoch,
+                                       xtime::timestamp_t endepoch)
+        {
+                double chunks_per_second = 0;
+                return get_candles_without_limits(symbol, candles, startepoch, endepoch, 1, chunks_per_second);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Установить размер буфера потока котировок
+         * Каждая валютная пара хранит не более capacity последних минутных баров.
+         * Новый размер применяется при следующем вызове init_symbols
+         * \param capacity Количество минутных баров на одну валютную пару
+         */
+        inline void set_stream_quotations_capacity(const size_t capacity)
+        {
+                quotes_capacity_ = std::max(capacity, (size_t)1);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Установить размер истории процентов выплат
+         * Каждая валютная пара хранит не более capacity последних значений по каждому направлению.
+         * Новый размер применяется при следующем вызове init_symbols
+         * \param capacity Количество значений на одну валютную пару и направление
+         */
+        inline void set_payout_history_capacity(const size_t capacity)
+        {
+                payouts_capacity_ = std::max(capacity, (size_t)1);
         }
 //------------------------------------------------------------------------------
         /** \brief Инициализировать список валютных пар
@@ -1359,21 +4744,85 @@ public:
                 proposal_buy_.resize(symbols.size());
                 proposal_sell_.clear();
                 proposal_sell_.resize(symbols.size());
+                proposal_buy_ids_.clear();
+                proposal_buy_ids_.resize(symbols.size());
+                proposal_sell_ids_.clear();
+                proposal_sell_ids_.resize(symbols.size());
                 proposal_mutex_.unlock();
 
-                quotations_mutex_.lock();
-                close_data_.clear();
-                time_data_.clear();
-                close_data_.resize(symbols.size());
-                time_data_.resize(symbols.size());
-                quotations_mutex_.unlock();
-
-                map_symbol_mutex_.lock();
+                std::lock_guard<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                quotes_.clear();
+                payouts_.clear();
                 map_symbol_.clear();
                 for(size_t i = 0; i < symbols_.size(); ++i) {
+                        quotes_.emplace_back(new RingBuffer<QuotationBar>(quotes_capacity_));
+                        payouts_.emplace_back(new RingBuffer<PayoutPoint>(payouts_capacity_));
+                        payouts_.emplace_back(new RingBuffer<PayoutPoint>(payouts_capacity_));
                         map_symbol_[symbols_[i]] = i;
                 }
-                map_symbol_mutex_.unlock();
+                reset_aggregator();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Запустить агрегатор тиков
+         * Агрегатор строит бары OHLC с количеством тиков сразу для нескольких периодов
+         * из одного потока котировок (init_stream_quotations), без отдельных подписок.
+         * Бары строятся только из тиков, пришедших после запуска агрегатора.
+         * Список валютных пар берется из init_symbols
+         * \param periods Периоды баров (секунды)
+         * \param capacity Количество баров каждого периода на одну валютную пару
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int init_candle_aggregator(const std::vector<unsigned long long> &periods = {5, 15, 60, 300, 3600},
+                                   const size_t capacity = BINARY_API_AGGREGATOR_CAPACITY)
+        {
+                for(size_t n = 0; n < periods.size(); ++n) {
+                        if(periods[n] == 0)
+                                return INVALID_PARAMETER;
+                }
+                std::lock_guard<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                aggregator_periods_ = periods;
+                aggregator_capacity_ = std::max(capacity, (size_t)1);
+                reset_aggregator();
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить бары агрегатора тиков
+         * \param symbol Символ
+         * \param period Период баров (секунды), один из указанных в init_candle_aggregator
+         * \param candles Бары (struct-of-arrays)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_aggregated_candles(const std::string &symbol,
+                                   const unsigned long long period,
+                                   CandleColumns &candles)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                RingBuffer<CandleBar> *bars = NULL;
+                int err_data = find_aggregated_candles(symbol, period, bars);
+                if(err_data != OK)
+                        return err_data;
+                bars->copy_fields(candles.timestamp, candles.open, candles.high,
+                                  candles.low, candles.close, candles.ticks);
+                return candles.timestamp.size() > 0 ? OK : DATA_NOT_AVAILABLE;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить бары агрегатора тиков
+         * \param symbol Символ
+         * \param period Период баров (секунды), один из указанных в init_candle_aggregator
+         * \param candles Бары
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_aggregated_candles(const std::string &symbol,
+                                   const unsigned long long period,
+                                   std::vector<CandleBar> &candles)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                RingBuffer<CandleBar> *bars = NULL;
+                int err_data = find_aggregated_candles(symbol, period, bars);
+                if(err_data != OK)
+                        return err_data;
+                bars->copy(candles);
+                return candles.size() > 0 ? OK : DATA_NOT_AVAILABLE;
         }
 //------------------------------------------------------------------------------
         /** \brief Инициализировать поток котировок
@@ -1387,11 +4836,11 @@ public:
                 is_stream_quotations_error_ = false;
 #               if BINARY_API_USE_TICKS_HISTORY_SUBSCRIBE == 0
                 for(size_t i = 0; i < symbols_.size(); ++i) {
-                        quotations_mutex_.lock();
-                        int err_data = get_candles(symbols_[i], init_size, close_data_.at(i), time_data_.at(i), 0, 0);
-                        quotations_mutex_.unlock();
+                        std::vector<QuotationBar> bars;
+                        int err_data = get_candles(symbols_[i], bars, 0, 0, init_size);
                         if(err_data != OK)
                                 return err_data;
+                        merge_quotes(symbols_[i], bars);
                 }
                 json j;
                 json j_array = json::array();
@@ -1403,19 +4852,17 @@ public:
                 int err_data = send_json(j);
                 if(err_data == OK) {
                         is_stream_quotations_ = true;
+                        resume_mutex_.lock();
+                        is_resume_quotations_ = true;
+                        resume_init_size_ = init_size;
+                        resume_mutex_.unlock();
                 }
                 return err_data;
 #               else
                 int err_data;
                 for(size_t i = 0; i < symbols_.size(); ++i) {
                         json j;
-                        j["ticks_history"] = symbols_[i];
-                        j["subscribe"] = 1;
-                        j["end"] = "latest";
-                        j["style"] = "candles";
-                        j["granularity"] = 60;
-                        j["adjust_start_time"] = 1;
-                        j["count"] = init_size;
+                        make_quotations_request(j, symbols_[i], init_size, 0);
                         err_data = send_json(j);
                         if(err_data != OK) {
                                 break;
@@ -1423,6 +4870,10 @@ public:
                 }
                 if(err_data == OK) {
                         is_stream_quotations_ = true;
+                        resume_mutex_.lock();
+                        is_resume_quotations_ = true;
+                        resume_init_size_ = init_size;
+                        resume_mutex_.unlock();
                 } else {
                         stop_stream_quotations();
                 }
@@ -1439,6 +4890,9 @@ public:
                 j["forget_all"] = "ticks";
                 is_stream_quotations_ = false;
                 is_stream_quotations_error_ = false;
+                resume_mutex_.lock();
+                is_resume_quotations_ = false;
+                resume_mutex_.unlock();
                 return send_json(j);
         }
 //------------------------------------------------------------------------------
@@ -1455,10 +4909,97 @@ public:
                         return NO_INIT;
                 }
 
-                quotations_mutex_.lock();
-                close_data = std::vector<std::vector<double>>(close_data_.cbegin(), close_data_.cend());
-                time_data = std::vector<std::vector<unsigned long long>>(time_data_.cbegin(), time_data_.cend());
-                quotations_mutex_.unlock();
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                close_data.resize(quotes_.size());
+                time_data.resize(quotes_.size());
+                std::vector<QuotationBar> bars;
+                for(size_t i = 0; i < quotes_.size(); ++i) {
+                        quotes_[i]->copy(bars);
+                        close_data[i].resize(bars.size());
+                        time_data[i].resize(bars.size());
+                        for(size_t n = 0; n < bars.size(); ++n) {
+                                close_data[i][n] = bars[n].close;
+                                time_data[i][n] = bars[n].timestamp;
+                        }
+                }
+                lock.unlock();
+                if(is_stream_quotations_error_)
+                        return UNKNOWN_ERROR;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить минутные свечи потока котировок (open, high, low, close)
+         * Порядок следования валютных пар зависит от порядка, указанного в массие функции init_symbols
+         * \param candles Свечи каждой валютной пары по полям (struct-of-arrays)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        inline int get_stream_candles(std::vector<QuotationColumns> &candles)
+        {
+                if(symbols_.size() == 0 || !is_stream_quotations_) {
+                        return NO_INIT;
+                }
+
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                candles.resize(quotes_.size());
+                for(size_t i = 0; i < quotes_.size(); ++i) {
+                        QuotationColumns &columns = candles[i];
+                        quotes_[i]->copy_fields(columns.timestamp, columns.close,
+                                                columns.open, columns.high, columns.low);
+                }
+                lock.unlock();
+                if(is_stream_quotations_error_)
+                        return UNKNOWN_ERROR;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить минутные свечи потока котировок одной валютной пары
+         * \param symbol Символ
+         * \param candles Свечи по полям (struct-of-arrays)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        inline int get_stream_candles(const std::string &symbol, QuotationColumns &candles)
+        {
+                if(symbols_.size() == 0 || !is_stream_quotations_) {
+                        return NO_INIT;
+                }
+
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end() || it_symbol->second >= (int)quotes_.size())
+                        return INVALID_PARAMETER;
+                quotes_[it_symbol->second]->copy_fields(candles.timestamp, candles.close,
+                                                         candles.open, candles.high, candles.low);
+                lock.unlock();
+                if(is_stream_quotations_error_)
+                        return UNKNOWN_ERROR;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить бары потока котировок, добавленные или измененные после прошлого вызова
+         * В отличие от get_stream_quotations, данные не копируются в массивы, а передаются
+         * в функцию func по одному бару. Память выделяется только при первом вызове (под курсоры).
+         * Порядок следования валютных пар зависит от порядка, указанного в массие функции init_symbols
+         * \param cursors Курсоры валютных пар. Перед первым вызовом передайте пустой массив
+         * \param func Функция вида void(const size_t indx, const QuotationBar &bar, const bool is_update),
+         * где indx - номер валютной пары, is_update - признак обновления цены последнего бара
+         * Внутри func нельзя вызывать init_symbols
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        template <class FUNC_TYPE>
+        int read_new_quotes(std::vector<QuotationCursor> &cursors, FUNC_TYPE func)
+        {
+                if(symbols_.size() == 0 || !is_stream_quotations_) {
+                        return NO_INIT;
+                }
+
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                if(cursors.size() != quotes_.size()) cursors.resize(quotes_.size());
+                for(size_t i = 0; i < quotes_.size(); ++i) {
+                        quotes_[i]->read_new(cursors[i], [&](const QuotationBar &bar, const bool is_update) {
+                                func(i, bar, is_update);
+                        });
+                }
+                lock.unlock();
                 if(is_stream_quotations_error_)
                         return UNKNOWN_ERROR;
                 return OK;
@@ -1490,8 +5031,60 @@ public:
                         return NO_INIT;
                 }
         }
+//------------------------------------------------------------------------------
+        /** \brief Получить текущее время сервера по локальным часам
+         * Время оценивается по ответам time и времени тиков без запроса к серверу.
+         * Запрос time отправляется сам только при подключении и когда погрешность
+         * становится больше BINARY_API_SERVER_CLOCK_MAX_ERROR
+         * \param timestamp Время сервера (секунды, с дробной частью)
+         * \param error Погрешность оценки (секунды)
+         * \return состояние ошибки (0 в случае успеха, NO_INIT, если время сервера еще не получено)
+         */
+        int now_server(double &timestamp, double &error)
+        {
+                check_server_clock_sync();
+                const double now = get_local_seconds(std::chrono::steady_clock::now());
+                std::lock_guard<std::mutex> lock(server_clock_mutex_);
+                if(!server_clock_.get(now, timestamp, error))
+                        return NO_INIT;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Дождаться начала следующей секунды сервера
+         * Функция ждет, пока даже с учетом погрешности оценки (см. now_server)
+         * не наступит время, кратное period
+         * \param timestamp Время сервера, которое наступило
+         * \param period Период (секунды), например 60 для начала минуты
+         * \return состояние ошибки (0 в случае успеха, NO_INIT, если время сервера
+         * не удалось получить за 5 секунд, иначе см. ErrorType)
+         */
+        int wait_until_server_second(unsigned long long &timestamp, const unsigned long long period = 1)
+        {
+                if(period == 0)
+                        return INVALID_PARAMETER;
+                double server_time = 0, error = 0;
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                while(now_server(server_time, error) != OK) {
+                        if(is_shutdown_ || std::chrono::steady_clock::now() - start > std::chrono::seconds(5))
+                                return NO_INIT;
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+                const unsigned long long target = ((unsigned long long)server_time / period + 1) * period;
+                while(!is_shutdown_) {
+                        if(now_server(server_time, error) != OK)
+                                return NO_INIT;
+                        const double wait = (double)target - (server_time - error);
+                        if(wait <= 0) break;
+                        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(wait, 1.0)));
+                }
+                timestamp = target;
+                return OK;
+        }
 //------------------------------------------------------------------------------
         /** \brief Инициализировать поток процентов выплат по ставке по одной валютной паре и одному направлению
+         * Функция не ждет отправки запроса: подписки отправляются в фоне в пределах лимита
+         * подписок (см. get_allowed_proposal_rate), готовность потока можно узнать
+         * функцией is_stream_proposal_ready
          * \param symbol имя валютной пары
          * \param amount размер ставки
          * \param contract_type тип контракта (см. ContractType)
@@ -1528,10 +5121,23 @@ public:
                 else if(duration_unit == TICKS) j["duration_unit"] = "t";
                 else if(duration_unit == DAYS) j["duration_unit"] = "d";
                 j["symbol"] = symbol;
-                return send_json(j);
+                if(!is_open_connection_)
+                        return NO_OPEN_CONNECTION;
+                // запрос без req_id, чтобы одинаковые подписки не повторялись
+                const std::string message = j.dump();
+                {
+                        // запомним подписку, чтобы восстановить ее после переподключения
+                        std::lock_guard<std::mutex> lock(resume_mutex_);
+                        if(std::find(resume_proposals_.begin(), resume_proposals_.end(), message) == resume_proposals_.end())
+                                resume_proposals_.push_back(message);
+                }
+                schedule_proposals(std::vector<std::string>(1, message));
+                return OK;
         }
 //------------------------------------------------------------------------------
         /** \brief Инициализировать поток процентов выплат по ставке по всем валютным парам
+         * Функция не блокирует поток: подписки отправляются в фоне в пределах лимита подписок.
+         * Торговать можно сразу по валютным парам, поток по которым уже работает (см. is_stream_proposal_ready)
          * \param amount размер ставки (помните об ограничениях брокера)
          * \param duration длительность контракта
          * \param duration_unit единица измерения длительности контракта (см. DurationType)
@@ -1545,107 +5151,24 @@ public:
         {
                 if(symbols_.size() == 0)
                         return NO_INIT;
-                // максимальное число запросов для подписки на проценты выплат в минуту - 25
-                int num_stream_proposal = 0;
-                const int max_num_stream_proposal = 25;
-                const float SECONDS_MINUTE = 60.0f;
-                std::chrono::duration<double> diff;
-                std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
-                std::chrono::time_point<std::chrono::steady_clock> stop = std::chrono::steady_clock::now();
-                //
+                const int contract_types[2] = {BUY, SELL};
                 for(size_t i = 0; i < symbols_.size(); ++i) {
-                        int err_data = init_stream_proposal(symbols_[i],
-                                                            amount,
-                                                            BUY,
-                                                            duration,
-                                                            duration_unit,
-                                                            currency);
-                        if(err_data != OK) {
-                                std::cout << "BinaryApi: init stream proposal error! Message: " <<
-                                        symbols_[i] << " BUY " << std::endl;
-                                return err_data;
-                        } else {
-                                std::cout << "BinaryApi: init stream proposal " <<
-                                        symbols_[i] << " BUY " << std::endl;
-                        }
-                        /* проверим ограничения на подписку о процентах выплат
-                         */
-                        num_stream_proposal++; // увеличим число запросов
-                        stop = std::chrono::steady_clock::now();
-                        diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                        // проверим, не прошла ли минута
-                        if(diff.count() < SECONDS_MINUTE) {
-                                // проверим число запросов в минуту
-                                if(num_stream_proposal >= max_num_stream_proposal) {
-                                        std::cout << "BinaryApi: init stream proposal wait..." << std::endl;
-                                        // число запросов слишком большое, ждем конца минуты
-                                        while(true) {
-                                                stop = std::chrono::steady_clock::now();
-                                                std::chrono::duration<double> diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                                                if(diff.count() >= SECONDS_MINUTE) {
-                                                        // минута прошла, уходим из ожидания
-                                                        start = std::chrono::steady_clock::now();
-                                                        stop = std::chrono::steady_clock::now();
-                                                        num_stream_proposal = 0;
-                                                        break;
-                                                }
-                                                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                                        } // while
-                                } // if
-                        } else {
-                                // минута прошла, обнуляем переменные
-                                start = std::chrono::steady_clock::now();
-                                stop = std::chrono::steady_clock::now();
-                                num_stream_proposal = 0;
-                        }
-                        /*
-                         */
-                        err_data = init_stream_proposal(symbols_[i],
-                                                        amount,
-                                                        SELL,
-                                                        duration,
-                                                        duration_unit,
-                                                        currency);
-                        if(err_data != OK) {
-                                std::cout << "BinaryApi: init streamn proposal error! Message: " <<
-                                        symbols_[i] << " SELL " << std::endl;
-                                return err_data;
-                        } else {
-                                std::cout << "BinaryApi: init stream proposal " <<
-                                        symbols_[i] << " SELL " << std::endl;
-                        }
-                        /* проверим ограничения на подписку о процентах выплат
-                         */
-                        num_stream_proposal++; // увеличим число запросов
-                        stop = std::chrono::steady_clock::now();
-                        diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                        // проверим, не прошла ли минута
-                        if(diff.count() < SECONDS_MINUTE) {
-                                // проверим число запросов в минуту
-                                if(num_stream_proposal >= max_num_stream_proposal) {
-                                        std::cout << "BinaryApi: init stream proposal wait..." << std::endl;
-                                        // число запросов слишком большое, ждем конца минуты
-                                        while(true) {
-                                                stop = std::chrono::steady_clock::now();
-                                                auto diff = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-                                                if(diff.count() >= SECONDS_MINUTE) {
-                                                        // минута прошла, уходим из ожидания
-                                                        start = std::chrono::steady_clock::now();
-                                                        stop = std::chrono::steady_clock::now();
-                                                        num_stream_proposal = 0;
-                                                        break;
-                                                }
-                                                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                                        } // while
-                                } // if
-                        } else {
-                                start = std::chrono::steady_clock::now();
-                                stop = std::chrono::steady_clock::now();
-                                num_stream_proposal = 0;
+                        for(int n = 0; n < 2; ++n) {
+                                int err_data = init_stream_proposal(symbols_[i],
+                                                                    amount,
+                                                                    contract_types[n],
+                                                                    duration,
+                                                                    duration_unit,
+                                                                    currency);
+                                if(err_data != OK) {
+                                        std::cout << "BinaryApi: init stream proposal error! Message: " <<
+                                                symbols_[i] << (contract_types[n] == BUY ? " BUY " : " SELL ") << std::endl;
+                                        return err_data;
+                                }
                         }
-                        /*
-                         */
                 }
+                std::cout << "BinaryApi: init stream proposal, subscriptions in rollout: " <<
+                        get_proposal_rollout_size() << std::endl;
                 is_stream_proposal_ = true;
                 return OK;
         }
@@ -1669,6 +5192,170 @@ public:
                 proposal_mutex_.unlock();
                 return OK;
         }
+//------------------------------------------------------------------------------
+        /** \brief Проверить, работает ли поток процентов выплат по валютной паре
+         * Пока подписки отправляются в фоне, по валютным парам с работающим потоком уже можно торговать
+         * \param symbol имя валютной пары
+         * \return вернет true, если сервер присылает проценты выплат по BUY и SELL
+         */
+        bool is_stream_proposal_ready(const std::string &symbol)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end()) return false;
+                const size_t indx = it_symbol->second;
+                lock.unlock();
+                std::lock_guard<std::mutex> proposal_lock(proposal_mutex_);
+                // init_symbols мог изменить размер массивов после поиска номера валютной пары
+                if(indx >= proposal_buy_ids_.size() || indx >= proposal_sell_ids_.size())
+                        return false;
+                return proposal_buy_ids_[indx].is_live && proposal_sell_ids_[indx].is_live;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить готовность потока процентов выплат по всем валютным парам
+         * Порядок следования валютных пар зависит от порядка, указанного в массие функции init_symbols
+         * \param buy_ready готовность потока по сделкам BUY
+         * \param sell_ready готовность потока по сделкам SELL
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_stream_proposal_ready(std::vector<bool> &buy_ready,
+                                      std::vector<bool> &sell_ready)
+        {
+                if(symbols_.size() == 0)
+                        return NO_INIT;
+                std::lock_guard<std::mutex> lock(proposal_mutex_);
+                buy_ready.resize(proposal_buy_ids_.size());
+                sell_ready.resize(proposal_sell_ids_.size());
+                for(size_t i = 0; i < proposal_buy_ids_.size(); ++i) buy_ready[i] = proposal_buy_ids_[i].is_live;
+                for(size_t i = 0; i < proposal_sell_ids_.size(); ++i) sell_ready[i] = proposal_sell_ids_[i].is_live;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить число подписок на проценты выплат, ждущих отправки
+         * \return количество подписок
+         */
+        size_t get_proposal_rollout_size()
+        {
+                std::lock_guard<std::mutex> lock(send_queue_mutex_);
+                return proposal_rollout_.size();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить последний процент выплат без блокировки потока соединения
+         * \param symbol имя валютной пары
+         * \param contract_type тип контракта (см. ContractType)
+         * \param payout процент выплат
+         * \param timestamp время сервера, когда процент выплат был получен
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_payout(const std::string &symbol,
+                       const int contract_type,
+                       double &payout,
+                       unsigned long long &timestamp)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                RingBuffer<PayoutPoint> *history = find_payouts(symbol, contract_type);
+                if(history == nullptr)
+                        return INVALID_PARAMETER;
+                PayoutPoint last;
+                if(!history->back(last))
+                        return DATA_NOT_AVAILABLE;
+                payout = last.payout;
+                timestamp = last.timestamp;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить процент выплат, действовавший в момент времени
+         * \param symbol имя валютной пары
+         * \param contract_type тип контракта (см. ContractType)
+         * \param timestamp время сервера
+         * \param payout процент выплат последнего обновления не позже timestamp
+         * \return состояние ошибки (0 в случае успеха, DATA_NOT_AVAILABLE, если
+         * время раньше начала истории, иначе см. ErrorType)
+         */
+        int get_payout_at(const std::string &symbol,
+                          const int contract_type,
+                          const unsigned long long timestamp,
+                          double &payout)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                RingBuffer<PayoutPoint> *history = find_payouts(symbol, contract_type);
+                if(history == nullptr)
+                        return INVALID_PARAMETER;
+                // ищем первое значение позже timestamp, время в истории не убывает
+                unsigned long long low = history->begin();
+                unsigned long long high = history->end();
+                PayoutPoint point;
+                while(low < high) {
+                        const unsigned long long middle = low + (high - low) / 2;
+                        if(!history->read(middle, point)) {
+                                // значение вытеснено новыми, начало истории сдвинулось
+                                low = std::max(low, history->begin());
+                                high = std::max(high, low);
+                                continue;
+                        }
+                        if(point.timestamp <= timestamp) low = middle + 1;
+                        else high = middle;
+                }
+                if(low == 0 || !history->read(low - 1, point))
+                        return DATA_NOT_AVAILABLE;
+                payout = point.payout;
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить историю процентов выплат
+         * \param symbol имя валютной пары
+         * \param contract_type тип контракта (см. ContractType)
+         * \param timestamps время сервера для каждого значения
+         * \param payouts проценты выплат
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_payout_history(const std::string &symbol,
+                               const int contract_type,
+                               std::vector<unsigned long long> &timestamps,
+                               std::vector<double> &payouts)
+        {
+                std::shared_lock<std::shared_timed_mutex> lock(map_symbol_mutex_);
+                RingBuffer<PayoutPoint> *history = find_payouts(symbol, contract_type);
+                if(history == nullptr)
+                        return INVALID_PARAMETER;
+                history->copy_fields(timestamps, payouts);
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить изменчивость процента выплат
+         * Считается среднеквадратичное отклонение значений за последние period секунд
+         * \param symbol имя валютной пары
+         * \param contract_type тип контракта (см. ContractType)
+         * \param period период (секунды)
+         * \param volatility среднеквадратичное отклонение процента выплат
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_payout_volatility(const std::string &symbol,
+                                  const int contract_type,
+                                  const unsigned long long period,
+                                  double &volatility)
+        {
+                std::vector<unsigned long long> timestamps;
+                std::vector<double> payouts;
+                int err = get_payout_history(symbol, contract_type, timestamps, payouts);
+                if(err != OK)
+                        return err;
+                if(timestamps.size() < 2)
+                        return DATA_NOT_AVAILABLE;
+                const unsigned long long start = timestamps.back() > period ? timestamps.back() - period : 0;
+                double sum = 0, sum_squares = 0;
+                size_t num = 0;
+                for(size_t i = timestamps.size(); i > 0 && timestamps[i - 1] >= start; --i) {
+                        sum += payouts[i - 1];
+                        sum_squares += payouts[i - 1] * payouts[i - 1];
+                        ++num;
+                }
+                if(num < 2)
+                        return DATA_NOT_AVAILABLE;
+                const double mean = sum / (double)num;
+                volatility = std::sqrt(std::max(0.0, sum_squares / (double)num - mean * mean));
+                return OK;
+        }
 //------------------------------------------------------------------------------
         /** \brief Остановить поток процентов выплат
          * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
@@ -1678,6 +5365,13 @@ public:
                 json j;
                 j["forget_all"] = "proposal";
                 is_stream_proposal_ = false;
+                resume_mutex_.lock();
+                resume_proposals_.clear();
+                resume_mutex_.unlock();
+                send_queue_mutex_.lock();
+                proposal_rollout_.clear();
+                send_queue_mutex_.unlock();
+                clear_proposal_ids();
                 return send_json(j);
         }
 //------------------------------------------------------------------------------
@@ -1738,7 +5432,96 @@ public:
                         ",\"duration_unit\":" + str_duration_unit +
                         ",\"symbol\":" + str_symbol + "},\"price\":" + str_amount + "}";
 
+                take_order_token();
+                connection_mutex_.lock();
+                save_connection_->send(message);
+                connection_mutex_.unlock();
+                return OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Открыть сделку по предложению потока процентов выплат
+         * Контракт покупается по proposal.id последнего обновления потока init_stream_proposal,
+         * поэтому серверу не нужно заново рассчитывать цену контракта. Запрос отправляется
+         * сразу, минуя очередь сообщений, а ответ сопоставляется с запросом по req_id.
+         * Каждое предложение используется один раз, следующее придет с обновлением потока
+         * \param symbol имя валютной пары
+         * \param contract_type тип контракта (см. ContractType, доступно BUY и SELL)
+         * \param callback Обработчик результата, вызывается из потока соединения
+         * \param price максимальная цена контракта. Если 0, используется цена из предложения
+         * \return состояние ошибки (OK = 0 в случае успеха, иначе см. ErrorType)
+         */
+        int send_order_by_proposal(const std::string &symbol,
+                                   const int contract_type,
+                                   std::function<void(const OrderResult &)> callback,
+                                   const double price = 0)
+        {
+                if(!is_authorize_)
+                        return NO_AUTHORIZATION;
+                if(contract_type != BUY && contract_type != SELL)
+                        return INVALID_PARAMETER;
+                std::shared_lock<std::shared_timed_mutex> symbol_lock(map_symbol_mutex_);
+                auto it_symbol = map_symbol_.find(symbol);
+                if(it_symbol == map_symbol_.end())
+                        return INVALID_PARAMETER;
+                const size_t indx = it_symbol->second;
+                symbol_lock.unlock();
+
+                ProposalId proposal;
+                proposal_mutex_.lock();
+                std::vector<ProposalId> &ids = contract_type == BUY ? proposal_buy_ids_ : proposal_sell_ids_;
+                if(indx < ids.size()) {
+                        proposal = ids[indx];
+                        ids[indx].id.clear();
+                }
+                proposal_mutex_.unlock();
+                if(proposal.id.empty())
+                        return DATA_NOT_AVAILABLE;
+
+                const long long req_id = ++last_req_id_;
+                const std::string message = "{\"buy\":\"" + proposal.id + "\",\"price\":" +
+                        format("%.2f", price > 0 ? price : proposal.ask_price) +
+                        ",\"req_id\":" + std::to_string(req_id) + "}";
+
+                const std::chrono::steady_clock::time_point send_time = std::chrono::steady_clock::now();
+                pending_requests_mutex_.lock();
+                pending_requests_[req_id] = [&, callback, send_time](json &j) {
+                        OrderResult result;
+                        result.latency = get_latency_us(receive_time_ - send_time);
+                        auto it_error = j.find("error");
+                        auto it_buy = j.find("buy");
+                        if(it_error != j.end()) {
+                                result.error = UNKNOWN_ERROR;
+                                auto it_code = it_error->find("code");
+                                auto it_message = it_error->find("message");
+                                if(it_code != it_error->end() && it_code->is_string()) result.error_code = *it_code;
+                                if(it_message != it_error->end() && it_message->is_string()) result.error_message = *it_message;
+                        } else
+                        if(it_buy == j.end() ||
+                           !get_number((*it_buy)["contract_id"], result.contract_id)) {
+                                result.error = UNKNOWN_ERROR;
+                        } else {
+                                get_number((*it_buy)["transaction_id"], result.transaction_id);
+                                get_number((*it_buy)["buy_price"], result.buy_price);
+                                get_number((*it_buy)["payout"], result.payout);
+                        }
+                        if(callback) callback(result);
+                };
+                pending_requests_mutex_.unlock();
+
+                // сделка занимает место в лимите до отправки, как в send_order
+                take_order_token();
                 connection_mutex_.lock();
+                if(!save_connection_ || !is_open_connection_) {
+                        connection_mutex_.unlock();
+                        pending_requests_mutex_.lock();
+                        pending_requests_.erase(req_id);
+                        pending_requests_mutex_.unlock();
+                        return NO_OPEN_CONNECTION;
+                }
+                latency_mutex_.lock();
+                request_send_times_[req_id] = send_time;
+                request_send_times_size_ = request_send_times_.size();
+                latency_mutex_.unlock();
                 save_connection_->send(message);
                 connection_mutex_.unlock();
                 return OK;
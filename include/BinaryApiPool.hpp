@@ -0,0 +1,490 @@
+/*
+* binary-cpp-api - Binary C++ API client
+*
+* Copyright (c) 2018 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINARYAPIPOOL_HPP_INCLUDED
+#define BINARYAPIPOOL_HPP_INCLUDED
+//------------------------------------------------------------------------------
+#include "BinaryApi.hpp"
+//------------------------------------------------------------------------------
+/** \brief Пул соединений для потоков котировок и процентов выплат
+ * Валютные пары делятся на группы, каждая группа подписывается через свое соединение.
+ * Еще одно соединение держится открытым в резерве. Если соединение группы
+ * обрывается, ее подписки сразу переносятся на резервное соединение, а оборванное
+ * соединение после переподключения становится резервным
+ */
+class BinaryApiPool
+{
+private:
+        std::vector<std::unique_ptr<BinaryAPI>> apis_;  // соединения (групп и резервное)
+        std::vector<std::string> symbols_;              // валютные пары в порядке init_symbols
+        std::vector<std::vector<size_t>> groups_;       // номера валютных пар каждой группы
+        std::vector<size_t> group_api_;                 // номер соединения каждой группы
+        int standby_ = -1;                              // номер резервного соединения
+        std::mutex mutex_;                              // защищает данные выше
+
+        std::mutex subscribe_mutex_;                    // не дает подписываться одновременно
+        bool is_stream_quotations_ = false;
+        int init_size_ = 0;
+        bool is_stream_proposal_ = false;
+        double amount_ = 0;
+        int duration_ = 0;
+        int duration_unit_ = 0;
+        std::string currency_;
+
+        std::vector<double> rates_;                     // сообщений в секунду по соединениям
+        std::vector<unsigned long long> last_count_;
+        std::mutex rates_mutex_;
+
+        std::atomic<bool> is_shutdown_;
+        bool is_check_ = false;                         // нужно проверить соединения
+        std::mutex check_mutex_;
+        std::condition_variable check_cond_;
+        std::thread monitor_thread_;
+//------------------------------------------------------------------------------
+        /** \brief Подписать группу на потоки через ее текущее соединение
+         * \param group Номер группы
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int subscribe_group(const size_t group)
+        {
+                std::vector<std::string> symbols;
+                mutex_.lock();
+                BinaryAPI &api = *apis_[group_api_[group]];
+                for(size_t i = 0; i < groups_[group].size(); ++i) {
+                        symbols.push_back(symbols_[groups_[group][i]]);
+                }
+                mutex_.unlock();
+                api.init_symbols(symbols);
+                if(is_stream_quotations_) {
+                        int err_data = api.init_stream_quotations(init_size_);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                }
+                if(is_stream_proposal_) {
+                        int err_data = api.init_stream_proposal(amount_, duration_, duration_unit_, currency_);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                }
+                return BinaryAPI::OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Проверить соединения групп
+         * Группа оборванного соединения переносится на резервное соединение.
+         * Если резерва нет, группа подписывается заново после переподключения
+         */
+        void check_groups()
+        {
+                std::lock_guard<std::mutex> subscribe_lock(subscribe_mutex_);
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        // пустой группе (групп больше, чем валютных пар) подписываться не на что
+                        if(groups_[g].size() == 0) continue;
+                        mutex_.lock();
+                        const size_t indx = group_api_[g];
+                        BinaryAPI &api = *apis_[indx];
+                        bool is_subscribe = false;
+                        bool is_moved = false;
+                        if(!api.is_connection()) {
+                                if(standby_ >= 0 && apis_[standby_]->is_connection()) {
+                                        // переносим подписки группы на резервное соединение
+                                        group_api_[g] = standby_;
+                                        standby_ = indx;
+                                        is_subscribe = true;
+                                        is_moved = true;
+                                        std::cout << "BinaryApiPool: group " << g << " moved to connection " <<
+                                                group_api_[g] << std::endl;
+                                }
+                        } else
+                        if((is_stream_quotations_ && !api.is_quotations_stream()) ||
+                           (is_stream_proposal_ && !api.is_proposal_stream())) {
+                                // соединение восстановлено, но подписки потеряны
+                                is_subscribe = true;
+                        }
+                        mutex_.unlock();
+                        if(is_moved) {
+                                // оборванное соединение после переподключения станет резервным,
+                                // поэтому оно не должно восстановить подписки перенесенной группы
+                                api.stop_stream_quotations();
+                                api.stop_stream_proposal();
+                                std::vector<std::string> empty_symbols;
+                                api.init_symbols(empty_symbols);
+                        }
+                        if(is_subscribe) subscribe_group(g);
+                }
+        }
+//------------------------------------------------------------------------------
+        /// Пересчитать скорость сообщений соединений
+        void update_rates(const double dt)
+        {
+                std::lock_guard<std::mutex> lock(rates_mutex_);
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        const unsigned long long count = apis_[i]->get_message_count();
+                        rates_[i] = dt > 0 ? (double)(count - last_count_[i]) / dt : 0.0;
+                        last_count_[i] = count;
+                }
+        }
+//------------------------------------------------------------------------------
+        void monitor_thread_loop()
+        {
+                const std::chrono::seconds RATE_PERIOD(1);
+                std::chrono::steady_clock::time_point last_rate_time = std::chrono::steady_clock::now();
+                while(!is_shutdown_) {
+                        {
+                                std::unique_lock<std::mutex> lock(check_mutex_);
+                                check_cond_.wait_until(lock, last_rate_time + RATE_PERIOD, [&]{
+                                        return is_shutdown_ || is_check_;
+                                });
+                                is_check_ = false;
+                        }
+                        if(is_shutdown_) break;
+                        check_groups();
+                        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                        if(now >= last_rate_time + RATE_PERIOD) {
+                                update_rates(std::chrono::duration<double>(now - last_rate_time).count());
+                                last_rate_time = now;
+                        }
+                }
+        }
+//------------------------------------------------------------------------------
+        /// Разбудить поток проверки соединений
+        void notify_monitor()
+        {
+                check_mutex_.lock();
+                is_check_ = true;
+                check_mutex_.unlock();
+                check_cond_.notify_one();
+        }
+//------------------------------------------------------------------------------
+        /** \brief Дождаться соединений, которые устанавливаются одновременно
+         * \param timeout_ms Время ожидания в миллисекундах
+         * \param order Номера соединений: сначала готовые, затем опоздавшие
+         */
+        void wait_ready(const long long timeout_ms, std::vector<size_t> &order)
+        {
+                std::vector<std::future<int>> ready;
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        ready.push_back(apis_[i]->wait_ready_async(timeout_ms));
+                }
+                std::vector<size_t> late;
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        if(ready[i].get() == BinaryAPI::OK) order.push_back(i);
+                        else late.push_back(i);
+                }
+                if(late.size() > 0) {
+                        std::cout << "BinaryApiPool: connections not ready: " << late.size() << std::endl;
+                }
+                order.insert(order.end(), late.begin(), late.end());
+        }
+//------------------------------------------------------------------------------
+        /** \brief Распределить соединения и запустить поток проверки соединений
+         * Группы получают готовые соединения, резервным становится опоздавшее соединение (если есть).
+         * Опоздавшие соединения подхватывает поток проверки соединений
+         * \param groups_num Количество групп валютных пар
+         * \param timeout_ms Время ожидания соединений в миллисекундах
+         */
+        void start(const size_t groups_num, const long long timeout_ms)
+        {
+                std::vector<size_t> order;
+                wait_ready(timeout_ms, order);
+                groups_.resize(std::max(groups_num, (size_t)1));
+                group_api_.resize(groups_.size());
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        group_api_[g] = order[g];
+                }
+                standby_ = order[groups_.size()];
+                rates_.resize(apis_.size());
+                last_count_.resize(apis_.size());
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        apis_[i]->set_disconnect_handler([&]() {
+                                notify_monitor();
+                        });
+                        last_count_[i] = apis_[i]->get_message_count();
+                }
+                monitor_thread_ = std::thread([&]() {
+                        monitor_thread_loop();
+                });
+        }
+//------------------------------------------------------------------------------
+public:
+        /** \brief Создать пул соединений
+         * Открывается groups_num + 1 соединений, одно из них резервное
+         * \param groups_num Количество групп валютных пар
+         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
+         * \param app_id ID API вашего приложения
+         * \param timeout_ms Время ожидания соединений в миллисекундах. Пул начинает работу
+         * с готовыми соединениями, остальные подключатся позже
+         */
+        BinaryApiPool(const size_t groups_num,
+                      std::string token = "",
+                      std::string app_id = "1089",
+                      const long long timeout_ms = 30000)
+                : is_shutdown_(false)
+        {
+                for(size_t i = 0; i <= std::max(groups_num, (size_t)1); ++i) {
+                        apis_.emplace_back(new BinaryAPI(BinaryAPI::ASYNC_CONNECTION, token, app_id));
+                }
+                start(groups_num, timeout_ms);
+        }
+//------------------------------------------------------------------------------
+        /** \brief Создать пул соединений в общем цикле событий
+         * \param event_loop Общий цикл событий
+         * \param groups_num Количество групп валютных пар
+         * \param token Токен. Можно указать пустую строку, но тогда не все функции будут доступны
+         * \param app_id ID API вашего приложения
+         * \param timeout_ms Время ожидания соединений в миллисекундах. Пул начинает работу
+         * с готовыми соединениями, остальные подключатся позже
+         */
+        BinaryApiPool(BinaryApiEventLoop &event_loop,
+                      const size_t groups_num,
+                      std::string token = "",
+                      std::string app_id = "1089",
+                      const long long timeout_ms = 30000)
+                : is_shutdown_(false)
+        {
+                for(size_t i = 0; i <= std::max(groups_num, (size_t)1); ++i) {
+                        apis_.emplace_back(new BinaryAPI(event_loop, BinaryAPI::ASYNC_CONNECTION, token, app_id));
+                }
+                start(groups_num, timeout_ms);
+        }
+//------------------------------------------------------------------------------
+        ~BinaryApiPool()
+        {
+                is_shutdown_ = true;
+                notify_monitor();
+                if(monitor_thread_.joinable()) monitor_thread_.join();
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        apis_[i]->set_disconnect_handler(nullptr);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Инициализировать список валютных пар
+         * Валютные пары распределяются по группам по очереди
+         * \param symbols Список валютных пар для получения котировок и процентов выплат
+         */
+        void init_symbols(std::vector<std::string> &symbols)
+        {
+                std::lock_guard<std::mutex> subscribe_lock(subscribe_mutex_);
+                mutex_.lock();
+                symbols_ = symbols;
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        groups_[g].clear();
+                }
+                for(size_t i = 0; i < symbols_.size(); ++i) {
+                        groups_[i % groups_.size()].push_back(i);
+                }
+                mutex_.unlock();
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        subscribe_group(g);
+                }
+        }
+//------------------------------------------------------------------------------
+        /** \brief Инициализировать поток котировок во всех группах
+         * \param init_size Начальный размер массива с котировками (в минутах)
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int init_stream_quotations(int init_size)
+        {
+                std::lock_guard<std::mutex> subscribe_lock(subscribe_mutex_);
+                if(symbols_.size() == 0)
+                        return BinaryAPI::NO_INIT;
+                init_size_ = init_size;
+                is_stream_quotations_ = true;
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        if(groups_[g].size() == 0) continue;
+                        // группу без соединения подпишет поток проверки соединений
+                        if(!apis_[group_api_[g]]->is_connection()) continue;
+                        int err_data = apis_[group_api_[g]]->init_stream_quotations(init_size);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                }
+                return BinaryAPI::OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Инициализировать поток процентов выплат во всех группах
+         * \param amount размер ставки
+         * \param duration длительность контракта
+         * \param duration_unit единица измерения длительности контракта (см. BinaryAPI::DurationType)
+         * \param currency валюта счета
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int init_stream_proposal(double amount,
+                                 int duration,
+                                 int duration_unit,
+                                 std::string currency = "USD")
+        {
+                std::lock_guard<std::mutex> subscribe_lock(subscribe_mutex_);
+                if(symbols_.size() == 0)
+                        return BinaryAPI::NO_INIT;
+                amount_ = amount;
+                duration_ = duration;
+                duration_unit_ = duration_unit;
+                currency_ = currency;
+                is_stream_proposal_ = true;
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        if(groups_[g].size() == 0) continue;
+                        // группу без соединения подпишет поток проверки соединений
+                        if(!apis_[group_api_[g]]->is_connection()) continue;
+                        int err_data = apis_[group_api_[g]]->init_stream_proposal(amount, duration, duration_unit, currency);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                }
+                return BinaryAPI::OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Остановить поток котировок во всех группах
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int stop_stream_quotations()
+        {
+                std::lock_guard<std::mutex> subscribe_lock(subscribe_mutex_);
+                is_stream_quotations_ = false;
+                int err_data = BinaryAPI::OK;
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        if(apis_[i]->is_quotations_stream()) {
+                                const int err = apis_[i]->stop_stream_quotations();
+                                if(err != BinaryAPI::OK) err_data = err;
+                        }
+                }
+                return err_data;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Остановить поток процентов выплат во всех группах
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int stop_stream_proposal()
+        {
+                std::lock_guard<std::mutex> subscribe_lock(subscribe_mutex_);
+                is_stream_proposal_ = false;
+                int err_data = BinaryAPI::OK;
+                for(size_t i = 0; i < apis_.size(); ++i) {
+                        if(apis_[i]->is_proposal_stream()) {
+                                const int err = apis_[i]->stop_stream_proposal();
+                                if(err != BinaryAPI::OK) err_data = err;
+                        }
+                }
+                return err_data;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить данные потока котировок
+         * Порядок следования валютных пар зависит от порядка, указанного в массиве функции init_symbols
+         * \param close_data массив цен закрытия минутных свечей
+         * \param time_data массив временных меток цен открытия минутных свечей
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_stream_quotations(std::vector<std::vector<double>> &close_data,
+                                  std::vector<std::vector<unsigned long long>> &time_data)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                close_data.resize(symbols_.size());
+                time_data.resize(symbols_.size());
+                std::vector<std::vector<double>> group_close;
+                std::vector<std::vector<unsigned long long>> group_time;
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        if(groups_[g].size() == 0) continue;
+                        int err_data = apis_[group_api_[g]]->get_stream_quotations(group_close, group_time);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                        if(group_close.size() != groups_[g].size()) return BinaryAPI::NO_INIT;
+                        for(size_t i = 0; i < groups_[g].size(); ++i) {
+                                close_data[groups_[g][i]].swap(group_close[i]);
+                                time_data[groups_[g][i]].swap(group_time[i]);
+                        }
+                }
+                return BinaryAPI::OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить минутные свечи потока котировок (open, high, low, close)
+         * Порядок следования валютных пар зависит от порядка, указанного в массиве функции init_symbols
+         * \param candles Свечи каждой валютной пары по полям
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_stream_candles(std::vector<BinaryAPI::QuotationColumns> &candles)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                candles.resize(symbols_.size());
+                std::vector<BinaryAPI::QuotationColumns> group_candles;
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        if(groups_[g].size() == 0) continue;
+                        int err_data = apis_[group_api_[g]]->get_stream_candles(group_candles);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                        if(group_candles.size() != groups_[g].size()) return BinaryAPI::NO_INIT;
+                        for(size_t i = 0; i < groups_[g].size(); ++i) {
+                                std::swap(candles[groups_[g][i]], group_candles[i]);
+                        }
+                }
+                return BinaryAPI::OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить данные потока процентов выплат
+         * Порядок следования валютных пар зависит от порядка, указанного в массиве функции init_symbols
+         * \param buy_data проценты выплат по сделкам BUY для всех валютных пар
+         * \param sell_data проценты выплат по сделкам SELL для всех валютных пар
+         * \return состояние ошибки (0 в случае успеха, иначе см. ErrorType)
+         */
+        int get_stream_proposal(std::vector<double> &buy_data,
+                                std::vector<double> &sell_data)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                buy_data.resize(symbols_.size());
+                sell_data.resize(symbols_.size());
+                std::vector<double> group_buy;
+                std::vector<double> group_sell;
+                for(size_t g = 0; g < groups_.size(); ++g) {
+                        if(groups_[g].size() == 0) continue;
+                        int err_data = apis_[group_api_[g]]->get_stream_proposal(group_buy, group_sell);
+                        if(err_data != BinaryAPI::OK) return err_data;
+                        if(group_buy.size() != groups_[g].size()) return BinaryAPI::NO_INIT;
+                        for(size_t i = 0; i < groups_[g].size(); ++i) {
+                                buy_data[groups_[g][i]] = group_buy[i];
+                                sell_data[groups_[g][i]] = group_sell[i];
+                        }
+                }
+                return BinaryAPI::OK;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить скорость сообщений каждого соединения
+         * Скорость пересчитывается раз в секунду
+         * \param rates Количество сообщений в секунду (индекс - номер соединения)
+         */
+        void get_rates(std::vector<double> &rates)
+        {
+                std::lock_guard<std::mutex> lock(rates_mutex_);
+                rates = rates_;
+        }
+//------------------------------------------------------------------------------
+        /** \brief Получить номера соединений групп
+         * \param group_api Номер соединения каждой группы
+         * \return номер резервного соединения
+         */
+        int get_groups(std::vector<size_t> &group_api)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                group_api = group_api_;
+                return standby_;
+        }
+//------------------------------------------------------------------------------
+        /// Получить количество соединений (вместе с резервным)
+        inline size_t get_connections_num() const {return apis_.size();}
+//------------------------------------------------------------------------------
+        /** \brief Получить соединение
+         * \param indx Номер соединения
+         * \return ссылка на соединение
+         */
+        inline BinaryAPI &get_connection(const size_t indx) {return *apis_.at(indx);}
+};
+//------------------------------------------------------------------------------
+#endif // BINARYAPIPOOL_HPP_INCLUDED